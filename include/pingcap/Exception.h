@@ -22,7 +22,9 @@ enum ErrorCodes : int
     RaftEntryTooLarge = 11,
     ServerIsBusy = 12,
     LeaderNotMatch = 13,
-    RegionEpochNotMatch = 14
+    RegionEpochNotMatch = 14,
+    DeadlineExceeded = 15,
+    RequestCanceled = 16
 };
 
 class Exception : public Poco::Exception
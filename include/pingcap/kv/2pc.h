@@ -19,6 +19,7 @@ struct TwoPhaseCommitter
 private:
     std::unordered_map<std::string, std::string> mutations;
 
+    // Sorted, as the buffer of the txn is.
     std::vector<std::string> keys;
     int64_t start_ts;
     int64_t commit_ts;
@@ -34,7 +35,8 @@ private:
 public:
     TwoPhaseCommitter(Txn * txn);
 
-    void execute();
+    // deadline bounds both the prewrite and the commit phase.
+    void execute(Deadline deadline = noDeadline);
 
 private:
     enum Action
@@ -44,34 +46,40 @@ private:
         ActionCleanUp
     };
 
-    struct BatchKeys
-    {
-        RegionVerID region;
-        std::vector<std::string> keys;
-        BatchKeys(const RegionVerID & region_, const std::vector<std::string> & keys_) : region(region_), keys(keys_) {}
-    };
+    // A batch is the keys in [begin, end) of keys, all in one region.
+    using BatchKeys = RegionKeys;
 
-    void prewriteKeys(Backoffer & bo, const std::vector<std::string> & keys) { doActionOnKeys<ActionPrewrite>(bo, keys); }
+    void prewriteKeys(Backoffer & bo, size_t begin, size_t end) { doActionOnKeys<ActionPrewrite>(bo, begin, end); }
 
-    void commitKeys(Backoffer & bo, const std::vector<std::string> & keys) { doActionOnKeys<ActionCommit>(bo, keys); }
+    void commitKeys(Backoffer & bo, size_t begin, size_t end) { doActionOnKeys<ActionCommit>(bo, begin, end); }
 
-    template <Action action>
-    void doActionOnKeys(Backoffer & bo, const std::vector<std::string> & key)
+    std::vector<BatchKeys> groupKeys(Backoffer & bo, size_t begin, size_t end)
     {
-        auto [groups, first_region] = cluster->region_cache->groupKeysByRegion(bo, keys);
+        std::vector<std::string_view> key_views(keys.begin() + begin, keys.begin() + end);
         // TODO: Limit size of every batch !
-        std::vector<BatchKeys> batches;
-        batches.push_back(BatchKeys(first_region, groups[first_region]));
-        groups.erase(first_region);
-
-        for (auto it = groups.begin(); it != groups.end(); it++)
+        std::vector<BatchKeys> batches = cluster->region_cache->groupSortedKeys(bo, key_views);
+        for (auto & batch : batches)
         {
-            batches.push_back(BatchKeys(first_region, groups[first_region]));
+            batch.begin += begin;
+            batch.end += begin;
         }
-        if (action == ActionCommit || action == ActionCleanUp)
+        return batches;
+    }
+
+    template <Action action>
+    void doActionOnKeys(Backoffer & bo, size_t begin, size_t end)
+    {
+        doActionOnBatchGroups<action>(bo, groupKeys(bo, begin, end));
+    }
+
+    template <Action action>
+    void doActionOnBatchGroups(Backoffer & bo, std::vector<BatchKeys> batches)
+    {
+        // The keys are sorted, the primary key is the first one, so is its batch.
+        if ((action == ActionCommit || action == ActionCleanUp) && !batches.empty() && batches.front().begin == 0)
         {
             doActionOnBatches<action>(bo, std::vector<BatchKeys>(batches.begin(), batches.begin() + 1));
-            batches = std::vector<BatchKeys>(batches.begin() + 1, batches.end());
+            batches.erase(batches.begin());
         }
         doActionOnBatches<action>(bo, batches);
     }
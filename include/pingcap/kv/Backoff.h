@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <map>
@@ -52,6 +53,14 @@ struct Backoff
     }
 
     int sleep()
+    {
+        int sleep_time = nextSleep();
+        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time));
+        return sleep_time;
+    }
+
+    // nextSleep advances the backoff state and returns how long to sleep, without sleeping.
+    int nextSleep()
     {
         int sleep_time = 0;
         int v = 0;
@@ -71,7 +80,6 @@ struct Backoff
             case DecorrJitter:
                 sleep_time = int(std::min(double(cap), double(base + rand() % (last_sleep * 3 - base))));
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time));
         attempts++;
         last_sleep = sleep_time;
         return last_sleep;
@@ -83,16 +91,35 @@ constexpr int scanMaxBackoff = 20000;
 constexpr int prewriteMaxBackoff = 20000;
 constexpr int commitMaxBackoff = 41000;
 constexpr int splitRegionBackoff = 20000;
+constexpr int loadSnapshotMaxBackoff = 5000;
+constexpr int loadStoresMaxBackoff = 5000;
 
 using BackoffPtr = std::shared_ptr<Backoff>;
 
+// Deadline is the time a caller gives up its whole operation, including all the retries.
+using Deadline = std::chrono::system_clock::time_point;
+
+constexpr Deadline noDeadline = Deadline::max();
+
 struct Backoffer
 {
     std::map<BackoffType, BackoffPtr> backoff_map;
     size_t total_sleep; // ms
     size_t max_sleep;   // ms
 
-    Backoffer(size_t max_sleep_) : total_sleep(0), max_sleep(max_sleep_) {}
+    // When defer_sleep is set, the first backoff is not slept but recorded in pending_sleep, so that an async caller can
+    // wait it out on a timer. Any further backoff before pending_sleep is taken sleeps as usual, which keeps nested retry
+    // loops (e.g. reloading a region from pd) from spinning.
+    bool defer_sleep;
+    size_t pending_sleep; // ms
+
+    // Every rpc sent with this backoffer ends no later than deadline, and a backoff that would sleep past it fails with
+    // DeadlineExceeded.
+    Deadline deadline;
+
+    Backoffer(size_t max_sleep_, Deadline deadline_ = noDeadline)
+        : total_sleep(0), max_sleep(max_sleep_), defer_sleep(false), pending_sleep(0), deadline(deadline_)
+    {}
 
     void backoff(BackoffType tp, const Exception & exc);
 };
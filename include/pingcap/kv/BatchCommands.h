@@ -0,0 +1,95 @@
+#pragma once
+
+#include <kvproto/tikvpb.grpc.pb.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <pingcap/Exception.h>
+#include <pingcap/Log.h>
+
+namespace pingcap
+{
+namespace kv
+{
+
+constexpr size_t batch_commands_max_size = 128;
+
+// BatchCommandsClient multiplexes requests to one store on a long-lived BatchCommands stream.
+// Callers put their requests in a queue. The send thread packs whatever is queued into one batch frame (so concurrent
+// requests are coalesced), and the receive thread routes every response back to its caller by request id.
+// If the stream breaks, the in-flight requests fail with GRPCErrorCode just like a failed unary call, and the stream is
+// rebuilt on the next request.
+class BatchCommandsClient
+{
+public:
+    BatchCommandsClient(std::shared_ptr<grpc::Channel> channel);
+
+    ~BatchCommandsClient();
+
+    // send blocks until the response of req arrives, or throws if the deadline is exceeded or the stream breaks.
+    tikvpb::BatchCommandsResponse::Response send(tikvpb::BatchCommandsRequest::Request && req, std::chrono::system_clock::time_point deadline);
+
+private:
+    struct Entry
+    {
+        uint64_t id;
+        tikvpb::BatchCommandsRequest::Request req;
+        tikvpb::BatchCommandsResponse::Response resp;
+        std::promise<void> promise;
+        std::atomic<bool> canceled;
+
+        Entry(uint64_t id_, tikvpb::BatchCommandsRequest::Request && req_) : id(id_), req(std::move(req_)), canceled(false) {}
+    };
+
+    using EntryPtr = std::shared_ptr<Entry>;
+
+    using Stream = grpc::ClientReaderWriter<tikvpb::BatchCommandsRequest, tikvpb::BatchCommandsResponse>;
+
+    void sendLoop();
+
+    void recvLoop(Stream * stream);
+
+    void connect();
+
+    void resetStream();
+
+    std::unique_ptr<tikvpb::Tikv::Stub> stub;
+
+    std::mutex mutex;
+
+    std::condition_variable cv;
+
+    // Requests waiting to be sent.
+    std::deque<EntryPtr> queue;
+
+    // Requests sent and waiting for their responses.
+    std::unordered_map<uint64_t, EntryPtr> pending;
+
+    uint64_t next_id;
+
+    bool stopped;
+
+    // Set by the receive thread when the stream is closed.
+    bool broken;
+
+    std::unique_ptr<grpc::ClientContext> context;
+
+    std::unique_ptr<Stream> stream;
+
+    std::thread recv_thread;
+
+    std::thread send_thread;
+
+    Logger * log;
+};
+
+using BatchCommandsClientPtr = std::shared_ptr<BatchCommandsClient>;
+
+} // namespace kv
+} // namespace pingcap
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <pingcap/kv/LockResolver.h>
 #include <pingcap/kv/RegionClient.h>
 #include <pingcap/kv/Rpc.h>
+#include <pingcap/kv/StoreProber.h>
 #include <pingcap/pd/Client.h>
 
 namespace pingcap
@@ -14,11 +16,21 @@ struct Cluster
     pd::ClientPtr pd_client;
     RegionCachePtr region_cache;
     RpcClientPtr rpc_client;
+    LockResolverPtr lock_resolver;
 
     Cluster(pd::ClientPtr pd_client_, RegionCachePtr region_cache_, RpcClientPtr rpc_client_)
-        : pd_client(pd_client_), region_cache(region_cache_), rpc_client(rpc_client_)
+        : pd_client(pd_client_),
+          region_cache(region_cache_),
+          rpc_client(rpc_client_),
+          lock_resolver(std::make_shared<LockResolver>(region_cache_, rpc_client_, pd_client_))
     {}
 
+    // startStoreProber makes requests avoid the stores that can't be connected.
+    void startStoreProber() { region_cache->setStoreProber(std::make_shared<StoreProber>(rpc_client)); }
+
+    // startStoreRefresher preloads all the stores and keeps them up to date, so region loads rarely ask PD for a store.
+    void startStoreRefresher() { region_cache->startStoreRefresher(); }
+
     // Only server for test.
     void splitRegion(const std::string & split_key)
     {
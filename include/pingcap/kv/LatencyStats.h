@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+
+#include <pingcap/kv/internal/type_traits.h>
+
+namespace pingcap
+{
+namespace kv
+{
+
+// A timeout derived from latencies is p99 * adaptive_timeout_factor, but not below adaptive_timeout_floor.
+constexpr int adaptive_timeout_factor = 4;
+constexpr std::chrono::milliseconds adaptive_timeout_floor(100);
+// Too few samples say nothing about p99.
+constexpr uint64_t adaptive_timeout_min_samples = 100;
+
+// LatencyHistogram is a lock free histogram with exponential buckets, from 50us to about 64s.
+// To follow recent latency, all counters are halved every latency_decay_period records.
+class LatencyHistogram
+{
+public:
+    static constexpr size_t bucket_count = 64;
+    static constexpr double min_bound_us = 50;
+    static constexpr double bucket_ratio = 1.25;
+    static constexpr uint64_t latency_decay_period = 4096;
+
+    LatencyHistogram() : total(0), records(0)
+    {
+        for (auto & bucket : buckets)
+            bucket = 0;
+    }
+
+    void record(std::chrono::microseconds latency)
+    {
+        buckets[bucketOf(latency.count())].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        if (records.fetch_add(1, std::memory_order_relaxed) % latency_decay_period == latency_decay_period - 1)
+        {
+            decay();
+        }
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    // percentile returns the upper bound of the bucket where the q-th (0 < q < 1) sample falls in.
+    std::chrono::microseconds percentile(double q) const
+    {
+        uint64_t n = count();
+        uint64_t rank = uint64_t(std::ceil(n * q));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; i++)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::chrono::microseconds(int64_t(upperBound(i)));
+        }
+        return std::chrono::microseconds(int64_t(upperBound(bucket_count - 1)));
+    }
+
+private:
+    static double upperBound(size_t i) { return min_bound_us * std::pow(bucket_ratio, double(i)); }
+
+    static size_t bucketOf(int64_t us)
+    {
+        if (us <= min_bound_us)
+            return 0;
+        size_t i = size_t(std::ceil(std::log(us / min_bound_us) / std::log(bucket_ratio)));
+        return std::min(i, bucket_count - 1);
+    }
+
+    // Racing records may be lost while halving, it doesn't matter for a statistic.
+    void decay()
+    {
+        uint64_t left = 0;
+        for (auto & bucket : buckets)
+        {
+            uint64_t v = bucket.load(std::memory_order_relaxed) / 2;
+            bucket.store(v, std::memory_order_relaxed);
+            left += v;
+        }
+        total.store(left, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, bucket_count> buckets;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> records;
+};
+
+// StoreLatency keeps a histogram per rpc type for one store.
+struct StoreLatency
+{
+    std::array<LatencyHistogram, rpcTypeCount> histograms;
+
+    void record(RpcType type, std::chrono::microseconds latency) { histograms[type].record(latency); }
+
+    std::chrono::microseconds p99(RpcType type) const { return histograms[type].percentile(0.99); }
+
+    // timeout returns p99 * adaptive_timeout_factor bounded to [adaptive_timeout_floor, ceiling], or ceiling if there are not
+    // enough samples yet.
+    std::chrono::milliseconds timeout(RpcType type, std::chrono::milliseconds ceiling) const
+    {
+        if (histograms[type].count() < adaptive_timeout_min_samples)
+            return ceiling;
+        auto t = std::chrono::duration_cast<std::chrono::milliseconds>(p99(type) * adaptive_timeout_factor);
+        return std::min(std::max(t, adaptive_timeout_floor), ceiling);
+    }
+};
+
+} // namespace kv
+} // namespace pingcap
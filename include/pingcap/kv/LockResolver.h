@@ -0,0 +1,85 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <pingcap/kv/RegionClient.h>
+#include <pingcap/pd/IClient.h>
+
+namespace pingcap
+{
+namespace kv
+{
+
+// Lock is a lock left on a key by a transaction that hasn't finished its commit.
+struct Lock
+{
+    std::string key;
+    std::string primary;
+    uint64_t txn_id;
+    uint64_t ttl;
+
+    Lock(const kvrpcpb::LockInfo & info)
+        : key(info.key()), primary(info.primary_lock()), txn_id(info.lock_version()), ttl(info.lock_ttl())
+    {}
+};
+
+// TxnStatus is the status of a transaction. While ttl is positive the transaction may still be running. Otherwise it
+// has committed at commit_ts, or has been rolled back if commit_ts is 0.
+struct TxnStatus
+{
+    uint64_t ttl;
+    uint64_t commit_ts;
+
+    bool isCommitted() const { return ttl == 0 && commit_ts > 0; }
+};
+
+// Number of finished transactions whose status a LockResolver remembers.
+constexpr size_t resolved_txn_cache_size = 2048;
+
+// LockResolver clears the locks that block reads and prewrites. The status of the transaction of a lock is asked from
+// its primary key with CheckTxnStatus, which also rolls back a primary lock that has expired. The locks of a finished
+// transaction are then committed or rolled back with one ResolveLock per region.
+class LockResolver
+{
+public:
+    LockResolver(RegionCachePtr cache_, RpcClientPtr client_, pd::ClientPtr pd_client_)
+        : cache(cache_), client(client_), pd_client(pd_client_), log(&Logger::get("pingcap.tikv"))
+    {}
+
+    // resolveLocks resolves the locks of the finished transactions. It returns 0 if all the locks are resolved,
+    // otherwise the ms until the first of the others expires, which the caller should back off for.
+    int64_t resolveLocks(Backoffer & bo, uint64_t caller_start_ts, const std::vector<Lock> & locks);
+
+private:
+    TxnStatus getTxnStatus(Backoffer & bo, const Lock & lock, uint64_t caller_start_ts, uint64_t current_ts);
+
+    // resolveLock resolves all the locks of the transaction in the region of lock, unless it is in cleaned_regions.
+    void resolveLock(Backoffer & bo, const Lock & lock, const TxnStatus & status, std::unordered_set<RegionVerID> & cleaned_regions);
+
+    bool getResolved(uint64_t txn_id, TxnStatus & status);
+
+    void saveResolved(uint64_t txn_id, const TxnStatus & status);
+
+    RegionCachePtr cache;
+
+    RpcClientPtr client;
+
+    pd::ClientPtr pd_client;
+
+    // The statuses of finished transactions never change, they are kept in the order they were resolved.
+    std::mutex mutex;
+
+    std::unordered_map<uint64_t, TxnStatus> resolved;
+
+    std::deque<uint64_t> resolved_order;
+
+    Logger * log;
+};
+
+using LockResolverPtr = std::shared_ptr<LockResolver>;
+
+} // namespace kv
+} // namespace pingcap
@@ -1,13 +1,24 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 
 #include <kvproto/errorpb.pb.h>
+#include <kvproto/kvrpcpb.pb.h>
 #include <kvproto/metapb.pb.h>
 
 #include <pingcap/Log.h>
 #include <pingcap/kv/Backoff.h>
+#include <pingcap/kv/SingleFlight.h>
+#include <pingcap/kv/internal/rcu.h>
+#include <pingcap/kv/internal/striped_counter.h>
 #include <pingcap/pd/Client.h>
 
 namespace pingcap
@@ -25,8 +36,18 @@ struct Store
     Store(uint64_t id_, const std::string & addr_, const std::string & peer_addr_, const std::map<std::string, std::string> & labels_)
         : id(id_), addr(addr_), peer_addr(peer_addr_), labels(labels_)
     {}
+
+    explicit Store(const metapb::Store & meta) : id(meta.id()), addr(meta.address()), peer_addr(meta.peer_address())
+    {
+        for (const auto & label : meta.labels())
+        {
+            labels[label.key()] = label.value();
+        }
+    }
 };
 
+using StoreMap = std::unordered_map<uint64_t, Store>;
+
 struct RegionVerID
 {
     uint64_t id;
@@ -37,6 +58,11 @@ struct RegionVerID
     RegionVerID(uint64_t id_, uint64_t conf_ver, uint64_t ver_) : id(id_), confVer(conf_ver), ver(ver_) {}
 
     bool operator==(const RegionVerID & rhs) const { return id == rhs.id && confVer == rhs.confVer && ver == rhs.ver; }
+
+    bool operator<(const RegionVerID & rhs) const
+    {
+        return std::tie(id, confVer, ver) < std::tie(rhs.id, rhs.confVer, rhs.ver);
+    }
 };
 
 } // namespace kv
@@ -58,21 +84,98 @@ namespace pingcap
 namespace kv
 {
 
+struct StoreLiveness;
+
+class StoreProber;
+
+// RPCContext is what a request to a peer of a region needs. It is immutable, the kvrpcpb::Context is built once and
+// requests on an arena share its messages.
+struct RPCContext
+{
+    RegionVerID region;
+    metapb::Peer peer;
+    std::string addr;
+    kvrpcpb::Context kv_ctx;
+
+    // The store epoch of the cache when addr was resolved.
+    uint64_t store_epoch;
+
+    // Liveness of the store at addr, null if stores are not probed.
+    std::shared_ptr<StoreLiveness> liveness;
+
+    RPCContext(const RegionVerID & region_, const metapb::Region & meta_, const metapb::Peer & peer_, const std::string & addr_,
+        uint64_t store_epoch_ = 0, std::shared_ptr<StoreLiveness> liveness_ = nullptr)
+        : region(region_), peer(peer_), addr(addr_), store_epoch(store_epoch_), liveness(std::move(liveness_))
+    {
+        kv_ctx.set_region_id(region.id);
+        kv_ctx.mutable_region_epoch()->CopyFrom(meta_.region_epoch());
+        kv_ctx.mutable_peer()->CopyFrom(peer);
+    }
+};
+
+using RPCContextPtr = std::shared_ptr<RPCContext>;
+
+// ReplicaContexts are the contexts of the peers of a region that serve replica reads, with the labels of their stores.
+struct ReplicaContexts
+{
+    uint64_t store_epoch;
+    uint64_t replica_epoch;
+
+    // Built again after this, to take back the replicas skipped for failing.
+    std::chrono::steady_clock::time_point expire_at;
+
+    std::vector<std::pair<RPCContextPtr, std::map<std::string, std::string>>> replicas;
+};
+
+using ReplicaContextsPtr = std::shared_ptr<const ReplicaContexts>;
+
+// Coarse clock of the region cache, in seconds.
+inline int64_t regionCacheNow()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 struct Region
 {
     metapb::Region meta;
     metapb::Peer peer;
     std::vector<metapb::Peer> learners;
 
+    // Set once the region is dropped or replaced in the cache. A published RegionIndex may still hold it.
+    std::atomic<bool> invalidated;
+
+    // When the region was looked up last, and the CLOCK reference bit. They decide expiry and eviction.
+    std::atomic<int64_t> last_access;
+
+    std::atomic<bool> referenced;
+
+    // The context of the leader, built on first use and read with std::atomic_load. A region in the cache never changes
+    // its leader, updateLeader replaces the region. A superseded context is freed once its last request finishes.
+    std::shared_ptr<RPCContext> rpc_ctx;
+
+    // The contexts of the replicas, built on the first replica read and read with std::atomic_load.
+    ReplicaContextsPtr replica_ctxs;
+
+    // Serializes building rpc_ctx and replica_ctxs, so concurrent misses build them once.
+    std::mutex rpc_ctx_mutex;
+
     Region(const metapb::Region & meta_, const metapb::Peer & peer_, const std::vector<metapb::Peer> & learners_)
-        : meta(meta_), peer(peer_), learners(learners_)
+        : meta(meta_),
+          peer(peer_),
+          learners(learners_),
+          invalidated(false),
+          last_access(regionCacheNow()),
+          referenced(true)
     {}
 
     const std::string & startKey() { return meta.start_key(); }
 
     const std::string & endKey() { return meta.end_key(); }
 
-    bool contains(const std::string & key) { return key >= startKey() && (key < endKey() || meta.end_key() == ""); }
+    bool contains(std::string_view key)
+    {
+        return key >= std::string_view(startKey()) && (key < std::string_view(endKey()) || meta.end_key() == "");
+    }
 
     RegionVerID verID()
     {
@@ -110,32 +213,144 @@ struct KeyLocation
         : region(region_), start_key(start_key_), end_key(end_key_)
     {}
 
-    bool contains(const std::string & key) { return key >= start_key && (key < end_key || end_key == ""); }
+    bool contains(std::string_view key) { return key >= std::string_view(start_key) && (key < std::string_view(end_key) || end_key == ""); }
 };
 
-struct RPCContext
+// RegionIndex is an immutable sorted snapshot of the cached regions. End keys are kept in one buffer with their common
+// prefix stripped, so a lookup is a binary search over contiguous memory.
+class RegionIndex
+{
+public:
+    RegionIndex() = default;
+
+    RegionIndex(const std::map<std::string, RegionPtr> & regions_map, const std::unordered_map<RegionVerID, RegionPtr> & regions);
+
+    // search returns the region containing key, or nullptr.
+    RegionPtr search(std::string_view key) const;
+
+    RegionPtr getByID(const RegionVerID & id) const;
+
+private:
+    std::string_view endKeySuffix(size_t i) const
+    {
+        return std::string_view(suffixes.data() + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+
+    // upperBound returns the index of the first end key greater than key.
+    size_t upperBound(std::string_view key) const;
+
+    std::string prefix;
+
+    std::string suffixes;
+
+    std::vector<uint32_t> offsets;
+
+    std::vector<RegionPtr> by_end_key;
+
+    // The region whose end key is empty, i.e. the last one.
+    RegionPtr last;
+
+    std::vector<std::pair<RegionVerID, RegionPtr>> by_id;
+};
+
+// Changes are published to the index once there are this many, or a 1/16 of the cache, whichever is larger.
+constexpr size_t region_index_min_batch = 16;
+
+constexpr std::chrono::milliseconds region_index_publish_interval(100);
+
+constexpr size_t dropped_ranges_max_size = 1024;
+
+// A region not looked up for this long is loaded again, as it is likely stale.
+constexpr std::chrono::seconds region_cache_ttl(600);
+
+// How many regions the CLOCK hand looks at on every insert to drop the expired ones.
+constexpr size_t region_cache_sweep_steps = 2;
+
+// RegionKeys is a run of sorted keys in one region, the keys in [begin, end) of the input.
+struct RegionKeys
 {
     RegionVerID region;
-    metapb::Region meta;
-    metapb::Peer peer;
-    std::string addr;
+    size_t begin;
+    size_t end;
 
-    RPCContext(const RegionVerID & region_, const metapb::Region & meta_, const metapb::Peer & peer_, const std::string & addr_)
-        : region(region_), meta(meta_), peer(peer_), addr(addr_)
-    {}
+    RegionKeys(const RegionVerID & region_, size_t begin_, size_t end_) : region(region_), begin(begin_), end(end_) {}
 };
 
-using RPCContextPtr = std::shared_ptr<RPCContext>;
+// groupSortedKeys splits inputs of at least this many keys per thread across threads.
+constexpr size_t group_keys_parallel_min = 1 << 16;
+
+// Regions seeded from a snapshot expire after this long unless they are used.
+constexpr std::chrono::seconds seeded_region_ttl(60);
+
+constexpr std::chrono::seconds region_cache_persist_interval(300);
+
+struct RegionCacheStats
+{
+    size_t size;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+// Number of regions loaded ahead of a range read that misses the cache.
+constexpr int region_prefetch_limit = 64;
+
+// How long prefetching stops after PD failed to scan regions.
+constexpr std::chrono::seconds region_prefetch_pause(10);
+
+// How long replica reads skip a store after a replica read to it failed.
+constexpr std::chrono::seconds replica_down_interval(10);
+
+// How often the store refresher reloads all the stores from PD.
+constexpr std::chrono::seconds store_refresh_interval(60);
 
 class RegionCache
 {
 public:
-    RegionCache(pd::ClientPtr pdClient_, std::string key_, std::string value_)
-        : pdClient(pdClient_), learner_key(std::move(key_)), learner_value(std::move(value_)), log(&Logger::get("pingcap.tikv"))
+    // max_regions_ caps the number of cached regions, 0 means no cap.
+    RegionCache(pd::ClientPtr pdClient_, std::string key_, std::string value_, size_t max_regions_ = 0,
+        std::chrono::seconds region_ttl_ = region_cache_ttl)
+        : pdClient(pdClient_),
+          max_regions(max_regions_),
+          region_ttl(region_ttl_),
+          replica_index(0),
+          store_epoch(0),
+          replica_epoch(0),
+          region_index(new RegionIndex()),
+          pending_changes(0),
+          region_loads(0),
+          saved_region_loads(0),
+          prefetch_paused_until(std::chrono::steady_clock::time_point()),
+          misses(0),
+          evictions(0),
+          persist_stop(false),
+          stores(new StoreMap()),
+          store_refresh_stop(false),
+          learner_key(std::move(key_)),
+          learner_value(std::move(value_)),
+          log(&Logger::get("pingcap.tikv"))
     {}
 
+    ~RegionCache()
+    {
+        stopStoreRefresher();
+        stopPersistence();
+        delete region_index.load();
+        delete stores.load();
+    }
+
     RPCContextPtr getRPCContext(Backoffer & bo, const RegionVerID & id);
 
+    // getReplicaRPCContext returns the context of a peer other than the leader: one of the selected learners if any,
+    // otherwise one of the followers, in round robin. If label_key is set, the peers on stores labeled with label_value
+    // are picked first, like the ones in the zone of the client. Peers on unreachable stores are skipped. Returns nullptr
+    // if there is no such peer.
+    RPCContextPtr getReplicaRPCContext(
+        Backoffer & bo, const RegionVerID & id, const std::string & label_key = "", const std::string & label_value = "");
+
+    // onReplicaSendReqFail makes replica reads skip the store of ctx for replica_down_interval.
+    void onReplicaSendReqFail(const RPCContext & ctx);
+
     void updateLeader(Backoffer & bo, const RegionVerID & region_id, uint64_t leader_store_id);
 
     KeyLocation locateKey(Backoffer & bo, const std::string & key);
@@ -150,12 +365,67 @@ public:
 
     RegionPtr getRegionByID(Backoffer & bo, const RegionVerID & id);
 
+    // getStore reads the cached stores without locking, and loads the store from PD on a miss.
     Store getStore(Backoffer & bo, uint64_t id);
 
+    // loadAllStores replaces the cached stores with all the stores PD knows, and returns their number. The contexts
+    // are built again if a store moved or is gone. Learners already selected for cached regions are kept.
+    size_t loadAllStores(Backoffer & bo);
+
+    // startStoreRefresher preloads all the stores, then reloads them every interval to pick up address and label
+    // changes. Failures are only logged.
+    void startStoreRefresher(std::chrono::seconds interval = store_refresh_interval);
+
+    void stopStoreRefresher();
+
     std::pair<std::unordered_map<RegionVerID, std::vector<std::string>>, RegionVerID> groupKeysByRegion(
         Backoffer & bo, const std::vector<std::string> & keys);
 
+    // groupSortedKeys groups sorted keys by region, in key order. Each group is found with one lookup and a binary search
+    // over the keys. Large inputs are split among threads.
+    std::vector<RegionKeys> groupSortedKeys(Backoffer & bo, const std::vector<std::string_view> & keys);
+
+    // loadRegionsInRange loads at most limit regions from the one containing start_key with a single PD request, and
+    // returns the number of regions cached.
+    size_t loadRegionsInRange(Backoffer & bo, const std::string & start_key, const std::string & end_key, int limit);
+
+    // prefetchRegions loads the regions ahead of start_key if it is not cached. Failures are ignored.
+    void prefetchRegions(Backoffer & bo, const std::string & start_key, const std::string & end_key);
+
+    // Number of region loads from PD, and of cache misses served by a load another caller had in flight.
+    uint64_t regionLoadCount() const { return region_loads.load(std::memory_order_relaxed); }
+
+    uint64_t savedRegionLoadCount() const { return saved_region_loads.load(std::memory_order_relaxed); }
+
+    RegionCacheStats stats();
+
+    // With a prober set, getRPCContext avoids stores it finds down. Set it before sending requests.
+    void setStoreProber(std::shared_ptr<StoreProber> prober) { store_prober = std::move(prober); }
+
+    // startPersistence seeds the cache from the snapshot at path if there is one. Then it saves the snapshot every
+    // interval and when the cache is destroyed.
+    void startPersistence(const std::string & path, std::chrono::seconds interval = region_cache_persist_interval);
+
+    void stopPersistence();
+
+    // saveSnapshot writes the cached regions and stores to path. loadSnapshot adds the regions in the snapshot at path
+    // that are not cached, and returns their number. Both only log failures.
+    bool saveSnapshot(const std::string & path);
+
+    size_t loadSnapshot(const std::string & path);
+
 private:
+    std::vector<RegionKeys> groupSortedKeyRange(Backoffer & bo, const std::vector<std::string_view> & keys, size_t begin, size_t end);
+
+    // loadRegionByKeyShared and loadRegionByIDShared load a region and insert it to the cache, sharing the PD request
+    // with concurrent callers missing the same region.
+    RegionPtr loadRegionByKeyShared(Backoffer & bo, const std::string & key);
+
+    RegionPtr loadRegionByIDShared(Backoffer & bo, uint64_t region_id);
+
+    // droppedRangeStart returns the start key of a recently dropped region containing key, or key itself.
+    std::string droppedRangeStart(const std::string & key);
+
     RegionPtr loadRegionByKey(Backoffer & bo, const std::string & key);
 
     RegionPtr loadRegionByID(Backoffer & bo, uint64_t region_id);
@@ -164,24 +434,136 @@ private:
 
     Store reloadStore(Backoffer & bo, uint64_t id);
 
+    std::optional<Store> findStore(uint64_t id);
+
+    // publishStoresLocked replaces the store map with new_stores. Requires store_mutex.
+    void publishStoresLocked(const StoreMap * new_stores);
+
     RegionPtr searchCachedRegion(const std::string & key);
 
     std::vector<metapb::Peer> selectLearner(Backoffer & bo, const metapb::Region & meta);
 
+    RegionPtr searchIndexedRegion(const std::string & key);
+
+    size_t scanRegions(Backoffer & bo, const std::string & start_key, const std::string & end_key, int limit);
+
     void insertRegionToCache(RegionPtr region);
 
+    // insertRegionLocked and evictLocked require region_mutex held exclusively.
+    void insertRegionLocked(const RegionPtr & region);
+
+    // evictLocked moves the clock hand over a few regions to drop expired ones, and further while the cache is over
+    // max_regions. keep is never evicted.
+    void evictLocked(const RegionPtr & keep);
+
+    void eraseRegionLocked(std::map<std::string, RegionPtr>::iterator it);
+
+    // getAlternateRPCContext returns the context of a voter of region other than the leader on a live store, or nullptr.
+    RPCContextPtr getAlternateRPCContext(Backoffer & bo, const RegionPtr & region);
+
+    bool isStoreAlive(const RPCContext & ctx) const;
+
+    // buildRPCContext resolves the store of the leader of region and sets the context of region.
+    RPCContextPtr buildRPCContext(Backoffer & bo, const RegionPtr & region);
+
+    bool isFresh(const ReplicaContexts & replicas) const;
+
+    // buildReplicaContexts resolves the stores of the replicas of region, except the ones that are down, and sets the
+    // replica contexts of region.
+    ReplicaContextsPtr buildReplicaContexts(Backoffer & bo, const RegionPtr & region);
+
+    // touch marks a cache hit on region, or returns false if it has expired.
+    bool touch(Region & region);
+
+    // maybePublishIndex and publishIndex require region_mutex held exclusively.
+    void maybePublishIndex();
+
+    void publishIndex();
+
+    // regions_map and regions are the authoritative cache, guarded by region_mutex. Readers look up region_index first,
+    // without any lock, and fall back to them for changes not published yet.
     std::map<std::string, RegionPtr> regions_map;
 
     std::unordered_map<RegionVerID, RegionPtr> regions;
 
-    std::map<uint64_t, Store> stores;
-
     pd::ClientPtr pdClient;
 
+    const size_t max_regions;
+
+    const std::chrono::seconds region_ttl;
+
+    std::shared_ptr<StoreProber> store_prober;
+
+    std::atomic<size_t> replica_index;
+
+    // Increased whenever a store is dropped, so the contexts with the address of a dropped store are built again.
+    std::atomic<uint64_t> store_epoch;
+
+    // Increased whenever a replica read fails, so the replica contexts are built again without the failed store.
+    std::atomic<uint64_t> replica_epoch;
+
+    // Until when replica reads skip each store, guarded by replica_down_mutex.
+    std::unordered_map<uint64_t, std::chrono::steady_clock::time_point> replica_down_until;
+
+    std::mutex replica_down_mutex;
+
     std::shared_mutex region_mutex;
 
+    std::atomic<const RegionIndex *> region_index;
+
+    Rcu region_rcu;
+
+    size_t pending_changes;
+
+    std::chrono::steady_clock::time_point last_publish;
+
+    // End key to start key of the dropped regions that have not been loaded again, guarded by region_mutex.
+    std::map<std::string, std::string> dropped_ranges;
+
+    SingleFlight<std::string, RegionPtr> key_loads;
+
+    SingleFlight<uint64_t, RegionPtr> id_loads;
+
+    std::atomic<uint64_t> region_loads;
+
+    std::atomic<uint64_t> saved_region_loads;
+
+    std::atomic<std::chrono::steady_clock::time_point> prefetch_paused_until;
+
+    // End key the CLOCK hand points to, guarded by region_mutex.
+    std::string clock_hand;
+
+    StripedCounter hits;
+
+    std::atomic<uint64_t> misses;
+
+    std::atomic<uint64_t> evictions;
+
+    std::string persist_path;
+
+    std::thread persist_thread;
+
+    std::mutex persist_mutex;
+
+    std::condition_variable persist_cv;
+
+    bool persist_stop;
+
+    // stores is replaced as a whole by writers serialized by store_mutex, and read under store_rcu without lock.
+    std::atomic<const StoreMap *> stores;
+
+    Rcu store_rcu;
+
     std::mutex store_mutex;
 
+    std::thread store_refresh_thread;
+
+    std::mutex store_refresh_mutex;
+
+    std::condition_variable store_refresh_cv;
+
+    bool store_refresh_stop;
+
     const std::string learner_key;
 
     const std::string learner_value;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <grpcpp/alarm.h>
+
 #include <pingcap/kv/Backoff.h>
 #include <pingcap/kv/Region.h>
 #include <pingcap/kv/Rpc.h>
@@ -18,6 +20,17 @@ namespace kv
 // RegionClient takes care of errors that does not relevant to region range, such as 'I/O timeout', 'NotLeader', and 'ServerIsBusy'.
 // For other errors, since region range have changed, the request may need to split, so we simply return the error to caller.
 
+// ReplicaRead routes reads to learners or followers instead of the leader.
+struct ReplicaRead
+{
+    bool enabled = false;
+
+    // If label_key is set, the replicas on stores labeled with label_value are read first, like the ones in the zone of
+    // the client. Otherwise the replicas are read in round robin.
+    std::string label_key;
+    std::string label_value;
+};
+
 struct RegionClient
 {
     RegionCachePtr cache;
@@ -34,6 +47,7 @@ struct RegionClient
     template <typename T>
     void sendReqToRegion(Backoffer & bo, RpcCallPtr<T> rpc)
     {
+        rpc->setDeadline(bo.deadline);
         for (;;)
         {
             RPCContextPtr ctx;
@@ -61,13 +75,236 @@ struct RegionClient
         }
     }
 
+    // Async twin of sendReqToRegion, done is called with the error sendReqToRegion would throw, or null on success.
+    // The backoffer is copied and owned by the request. Retries are driven by the poller threads of the rpc client, and the
+    // backoff between them is waited out on an alarm instead of a sleeping thread. Note that a region cache miss still
+    // loads the region from pd synchronously.
+    template <typename T>
+    void sendReqToRegionAsync(const Backoffer & bo, RpcCallPtr<T> rpc, RpcCallback done)
+    {
+        rpc->setDeadline(bo.deadline);
+        auto * req = new AsyncRequest<T>(*this, bo, rpc, std::move(done));
+        req->send();
+    }
+
+    template <typename T>
+    std::future<void> sendReqToRegionAsync(const Backoffer & bo, RpcCallPtr<T> rpc)
+    {
+        auto promise = std::make_shared<std::promise<void>>();
+        auto future = promise->get_future();
+        sendReqToRegionAsync(bo, rpc, [promise](std::exception_ptr err) {
+            if (err)
+                promise->set_exception(err);
+            else
+                promise->set_value();
+        });
+        return future;
+    }
+
+    // sendReqToReplica sends a read to a replica picked by replica. The request is marked as a replica read, so the
+    // replica asks the leader for its read index and waits to apply up to it before reading, which keeps the read
+    // linearizable. If there is no replica, or it fails or returns a region error, the request is sent to the leader.
+    // A replica that fails is skipped by replica reads for replica_down_interval.
+    template <typename T>
+    void sendReqToReplica(Backoffer & bo, RpcCallPtr<T> rpc, const ReplicaRead & replica)
+    {
+        rpc->setDeadline(bo.deadline);
+        RPCContextPtr ctx = getReplicaRPCContext(bo, replica);
+        if (ctx != nullptr)
+        {
+            rpc->setCtx(ctx);
+            rpc->getReq()->mutable_context()->set_replica_read(true);
+            try
+            {
+                client->sendRequest(ctx->addr, rpc);
+                if (!rpc->getResp()->has_region_error())
+                    return;
+                log->debug("replica read of region " + std::to_string(region_id.id) + " failed: " + rpc->getResp()->region_error().message());
+            }
+            catch (const Exception & e)
+            {
+                if (e.code() == DeadlineExceeded || e.code() == RequestCanceled)
+                    e.rethrow();
+                log->warning("replica read of region " + std::to_string(region_id.id) + " failed: " + e.displayText());
+                cache->onReplicaSendReqFail(*ctx);
+            }
+            rpc->getReq()->mutable_context()->set_replica_read(false);
+        }
+        sendReqToRegion(bo, rpc);
+    }
+
+    // Async twin of sendReqToReplica.
+    template <typename T>
+    void sendReqToReplicaAsync(const Backoffer & bo, RpcCallPtr<T> rpc, const ReplicaRead & replica, RpcCallback done)
+    {
+        rpc->setDeadline(bo.deadline);
+        Backoffer replica_bo = bo;
+        RPCContextPtr ctx = getReplicaRPCContext(replica_bo, replica);
+        if (ctx != nullptr)
+        {
+            rpc->setCtx(ctx);
+            rpc->getReq()->mutable_context()->set_replica_read(true);
+            RegionClient self = *this;
+            try
+            {
+                client->sendRequestAsync(ctx->addr, rpc, [self, bo, rpc, ctx, done](std::exception_ptr err) mutable {
+                    if (!err && !rpc->getResp()->has_region_error())
+                    {
+                        done(nullptr);
+                        return;
+                    }
+                    if (err && isCanceledOrTimeout(err))
+                    {
+                        done(err);
+                        return;
+                    }
+                    if (err)
+                    {
+                        self.cache->onReplicaSendReqFail(*ctx);
+                    }
+                    rpc->getReq()->mutable_context()->set_replica_read(false);
+                    self.sendReqToRegionAsync(bo, rpc, done);
+                });
+                return;
+            }
+            catch (const Exception & e)
+            {
+                log->warning("replica read of region " + std::to_string(region_id.id) + " failed: " + e.displayText());
+                cache->onReplicaSendReqFail(*ctx);
+            }
+            rpc->getReq()->mutable_context()->set_replica_read(false);
+        }
+        sendReqToRegionAsync(bo, rpc, std::move(done));
+    }
+
+    template <typename T>
+    std::future<void> sendReqToReplicaAsync(const Backoffer & bo, RpcCallPtr<T> rpc, const ReplicaRead & replica)
+    {
+        auto promise = std::make_shared<std::promise<void>>();
+        auto future = promise->get_future();
+        sendReqToReplicaAsync(bo, rpc, replica, [promise](std::exception_ptr err) {
+            if (err)
+                promise->set_exception(err);
+            else
+                promise->set_value();
+        });
+        return future;
+    }
+
 protected:
+    // isCanceledOrTimeout tells if err is DeadlineExceeded or RequestCanceled, which must not be retried on the leader.
+    static bool isCanceledOrTimeout(std::exception_ptr err);
+
+    // getReplicaRPCContext returns nullptr if the region has no replica to read, or it can't be located.
+    RPCContextPtr getReplicaRPCContext(Backoffer & bo, const ReplicaRead & replica);
+
+    // AsyncRequest runs the retry loop of sendReqToRegion as a state machine. It deletes itself after calling done.
+    template <typename T>
+    struct AsyncRequest;
+
     void onRegionError(Backoffer & bo, RPCContextPtr rpc_ctx, const errorpb::Error & err);
 
     // Normally, it happens when machine down or network partition between tidb and kv or process crash.
     void onSendFail(Backoffer & bo, const Exception & e, RPCContextPtr rpc_ctx);
 };
 
+template <typename T>
+struct RegionClient::AsyncRequest : public AsyncCallTag
+{
+    RegionClient region_client;
+    Backoffer bo;
+    RpcCallPtr<T> rpc;
+    RpcCallback done;
+    RPCContextPtr ctx;
+    std::unique_ptr<grpc::Alarm> alarm;
+
+    AsyncRequest(const RegionClient & region_client_, const Backoffer & bo_, RpcCallPtr<T> rpc_, RpcCallback done_)
+        : region_client(region_client_), bo(bo_), rpc(rpc_), done(std::move(done_))
+    {}
+
+    void send()
+    {
+        if (rpc->isCanceled())
+        {
+            finish(std::make_exception_ptr(Exception("request canceled", RequestCanceled)));
+            return;
+        }
+        try
+        {
+            ctx = region_client.cache->getRPCContext(bo, region_client.region_id);
+            rpc->setCtx(ctx);
+            region_client.client->sendRequestAsync(ctx->addr, rpc, [this](std::exception_ptr err) { onResponse(err); });
+        }
+        catch (...)
+        {
+            finish(std::current_exception());
+        }
+    }
+
+    void onResponse(std::exception_ptr err)
+    {
+        bo.defer_sleep = true;
+        try
+        {
+            if (err)
+            {
+                try
+                {
+                    std::rethrow_exception(err);
+                }
+                catch (const Exception & e)
+                {
+                    region_client.onSendFail(bo, e, ctx);
+                }
+            }
+            else if (rpc->getResp()->has_region_error())
+            {
+                region_client.onRegionError(bo, ctx, rpc->getResp()->region_error());
+            }
+            else
+            {
+                finish(nullptr);
+                return;
+            }
+        }
+        catch (...)
+        {
+            finish(std::current_exception());
+            return;
+        }
+        bo.defer_sleep = false;
+
+        size_t sleep_time = bo.pending_sleep;
+        bo.pending_sleep = 0;
+        if (sleep_time == 0)
+        {
+            send();
+            return;
+        }
+        alarm = std::make_unique<grpc::Alarm>();
+        alarm->Set(region_client.client->asyncPoller().getQueue(),
+            std::chrono::system_clock::now() + std::chrono::milliseconds(sleep_time),
+            this);
+    }
+
+    // The alarm fires, or is cancelled when the queue shuts down. A dead queue can't take another call.
+    void proceed(bool ok) override
+    {
+        if (!ok)
+        {
+            finish(std::make_exception_ptr(Exception("request canceled: the completion queue is shut down", RequestCanceled)));
+            return;
+        }
+        send();
+    }
+
+    void finish(std::exception_ptr err)
+    {
+        std::unique_ptr<AsyncRequest> self(this);
+        done(err);
+    }
+};
+
 using RegionClientPtr = std::shared_ptr<RegionClient>;
 
 } // namespace kv
@@ -1,12 +1,21 @@
 #pragma once
 
+#include <google/protobuf/arena.h>
+#include <grpcpp/completion_queue.h>
 #include <grpcpp/create_channel.h>
 #include <grpcpp/security/credentials.h>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <mutex>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include <pingcap/Log.h>
+#include <pingcap/kv/BatchCommands.h>
+#include <pingcap/kv/LatencyStats.h>
 #include <pingcap/kv/Region.h>
 #include <pingcap/kv/internal/type_traits.h>
 
@@ -15,42 +24,143 @@ namespace pingcap
 namespace kv
 {
 
+// ConnArray holds a few channels to one store. The stub of every channel is built once and shared by all requests.
 struct ConnArray
 {
-    std::mutex mutex;
-
-    size_t index;
+    std::atomic<size_t> index;
     std::vector<std::shared_ptr<grpc::Channel>> vec;
+    std::vector<std::shared_ptr<tikvpb::Tikv::Stub>> stubs;
+    // One BatchCommands stream per channel, empty if batching is disabled.
+    std::vector<BatchCommandsClientPtr> batch_clients;
+    // Latency of the requests sent to this store.
+    StoreLatency latency;
 
-    ConnArray() = default;
-
-    ConnArray(size_t max_size, std::string addr);
+    ConnArray(size_t max_size, std::string addr, bool enable_batch);
 
     std::shared_ptr<grpc::Channel> get();
+
+    std::shared_ptr<tikvpb::Tikv::Stub> getStub();
+
+    BatchCommandsClientPtr getBatchClient();
+
+private:
+    size_t nextIndex() { return index.fetch_add(1, std::memory_order_relaxed) % vec.size(); }
 };
 
 using ConnArrayPtr = std::shared_ptr<ConnArray>;
 
+// AsyncCallTag is the tag put on a completion queue, the poller calls proceed once the operation is done.
+struct AsyncCallTag
+{
+    virtual ~AsyncCallTag() = default;
+
+    virtual void proceed(bool ok) = 0;
+};
+
+// AsyncPoller owns several completion queues, each of them is drained by its own thread.
+class AsyncPoller
+{
+public:
+    AsyncPoller(size_t size);
+
+    ~AsyncPoller();
+
+    // getQueue picks a completion queue in round robin.
+    grpc::CompletionQueue * getQueue();
+
+private:
+    // run only uses what it is given, since the poller may be destroyed by a callback on its own thread.
+    static void run(std::shared_ptr<grpc::CompletionQueue> cq, Logger * log);
+
+    std::vector<std::shared_ptr<grpc::CompletionQueue>> queues;
+
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> index;
+
+    Logger * log;
+};
+
+constexpr size_t async_poller_size = 4;
+
+// RpcCallback is invoked from a poller thread when an async request finishes, err is null on success.
+using RpcCallback = std::function<void(std::exception_ptr err)>;
+
+// rpc_timeout is the timeout of a single attempt.
+constexpr std::chrono::seconds rpc_timeout(3);
+
+constexpr size_t arena_min_block_size = 256;
+constexpr size_t arena_max_block_size = 4 << 20;
+
+// ArenaSizeHint remembers how much arena memory the recent calls of one request type used, so that the arena of the next
+// call can be created with a first block large enough to hold the whole request and response. The hint follows growth at
+// once and decays slowly.
+template <class T>
+struct ArenaSizeHint
+{
+    static std::atomic<size_t> & value()
+    {
+        static std::atomic<size_t> hint(arena_min_block_size);
+        return hint;
+    }
+
+    static void update(size_t used)
+    {
+        size_t old = value().load(std::memory_order_relaxed);
+        value().store(std::max(used, old - old / 8), std::memory_order_relaxed);
+    }
+};
+
 template <class T>
-class RpcCall
+class RpcCall : public std::enable_shared_from_this<RpcCall<T>>
 {
 
     using Trait = RpcTypeTraits<T>;
     using S = typename Trait::ResultType;
 
+    // The context set last, req may point into it. Declared before arena to outlive it.
+    RPCContextPtr ctx_holder;
+    // If arena is set, req and resp live on it.
+    std::unique_ptr<google::protobuf::Arena> arena;
     T * req;
     S * resp;
+    // The deadline of the caller, an attempt never outlives it.
+    Deadline caller_deadline;
+    std::chrono::milliseconds attempt_timeout;
+    // cancel_mutex protects inflight, the context of the unary attempt in progress.
+    std::mutex cancel_mutex;
+    grpc::ClientContext * inflight;
+    std::atomic<bool> canceled;
     Logger * log;
 
 public:
-    RpcCall(T * t) : log(&Logger::get("pingcap.tikv"))
+    // Takes the ownership of t, the request and response are allocated on the heap.
+    RpcCall(T * t) : caller_deadline(noDeadline), attempt_timeout(rpc_timeout), inflight(nullptr), canceled(false), log(&Logger::get("pingcap.tikv"))
     {
         req = t;
         resp = new S();
     }
 
+    // Allocates the request and response on an arena owned by the call, fill the request through getReq().
+    RpcCall()
+        : arena(newArena()),
+          caller_deadline(noDeadline),
+          attempt_timeout(rpc_timeout),
+          inflight(nullptr),
+          canceled(false),
+          log(&Logger::get("pingcap.tikv"))
+    {
+        req = google::protobuf::Arena::CreateMessage<T>(arena.get());
+        resp = google::protobuf::Arena::CreateMessage<S>(arena.get());
+    }
+
     ~RpcCall()
     {
+        if (arena != nullptr)
+        {
+            ArenaSizeHint<T>::update(arena->SpaceUsed());
+            return;
+        }
         if (req != nullptr)
         {
             delete req;
@@ -61,41 +171,189 @@ public:
         }
     }
 
+    // setCtx fills the context in place, leaving its other fields as they are. A request on an arena borrows the epoch
+    // and peer messages of rpc_ctx instead of copying them: the arena never frees them, the call keeps rpc_ctx alive,
+    // and nothing modifies them.
     void setCtx(RPCContextPtr rpc_ctx)
     {
-        kvrpcpb::Context * ctx = new kvrpcpb::Context();
-        ctx->set_region_id(rpc_ctx->region.id);
-        ctx->set_allocated_region_epoch(new metapb::RegionEpoch(rpc_ctx->meta.region_epoch()));
-        ctx->set_allocated_peer(new metapb::Peer(rpc_ctx->peer));
-        req->set_allocated_context(ctx);
+        kvrpcpb::Context * ctx = req->mutable_context();
+        ctx->set_region_id(rpc_ctx->kv_ctx.region_id());
+        if (arena != nullptr)
+        {
+            ctx->unsafe_arena_set_allocated_region_epoch(const_cast<metapb::RegionEpoch *>(&rpc_ctx->kv_ctx.region_epoch()));
+            ctx->unsafe_arena_set_allocated_peer(const_cast<metapb::Peer *>(&rpc_ctx->kv_ctx.peer()));
+        }
+        else
+        {
+            ctx->mutable_region_epoch()->CopyFrom(rpc_ctx->kv_ctx.region_epoch());
+            ctx->mutable_peer()->CopyFrom(rpc_ctx->kv_ctx.peer());
+        }
+        ctx_holder = std::move(rpc_ctx);
+    }
+
+    void setDeadline(Deadline deadline) { caller_deadline = deadline; }
+
+    void setAttemptTimeout(std::chrono::milliseconds timeout) { attempt_timeout = timeout; }
+
+    // cancel aborts the attempt in progress and makes the call fail with RequestCanceled, so that it's not retried. It can be
+    // called from any thread. A call on a BatchCommands stream is not aborted, but its result is still RequestCanceled.
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(cancel_mutex);
+        canceled = true;
+        if (inflight != nullptr)
+            inflight->TryCancel();
     }
 
+    bool isCanceled() const { return canceled; }
+
+    T * getReq() { return req; }
+
     S * getResp() { return resp; }
 
-    void call(std::unique_ptr<tikvpb::Tikv::Stub> stub)
+    void call(tikvpb::Tikv::Stub * stub)
     {
         grpc::ClientContext context;
-        context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(3));
-        auto status = Trait::doRPCCall(&context, std::move(stub), *req, resp);
-        if (!status.ok())
+        applyDeadline(context);
+        setInflight(&context);
+        auto status = Trait::doRPCCall(&context, stub, *req, resp);
+        setInflight(nullptr);
+        if (!status.ok() || canceled)
         {
-            std::string err_msg = std::string(Trait::err_msg()) + std::to_string(status.error_code()) + ": " + status.error_message();
-            log->error(err_msg);
-            throw Exception(err_msg, GRPCErrorCode);
+            std::rethrow_exception(errorOf(status));
         }
     }
+
+    // callAsync starts the call on cq and returns at once, done is called by the poller thread of cq.
+    void callAsync(std::shared_ptr<tikvpb::Tikv::Stub> stub, grpc::CompletionQueue * cq, RpcCallback done)
+    {
+        auto * state = new AsyncState(this->shared_from_this(), std::move(stub), std::move(done));
+        applyDeadline(state->context);
+        setInflight(&state->context);
+        state->reader = Trait::doAsyncRPCCall(&state->context, state->stub.get(), *req, cq);
+        state->reader->StartCall();
+        state->reader->Finish(resp, &state->status, state);
+    }
+
+    // callBatch sends the request on a BatchCommands stream instead of a unary call.
+    void callBatch(BatchCommandsClient & client)
+    {
+        tikvpb::BatchCommandsRequest::Request batch_req;
+        Trait::toBatch(*req, &batch_req);
+        tikvpb::BatchCommandsResponse::Response batch_resp;
+        try
+        {
+            batch_resp = client.send(std::move(batch_req), attemptDeadline());
+        }
+        catch (const Exception & e)
+        {
+            if (std::chrono::system_clock::now() >= caller_deadline)
+                throw Exception(std::string(Trait::err_msg()) + " deadline exceeded", DeadlineExceeded);
+            throw;
+        }
+        if (canceled)
+            throw Exception(std::string(Trait::err_msg()) + " canceled", RequestCanceled);
+        Trait::fromBatch(&batch_resp, resp);
+    }
+
+private:
+    // AsyncState keeps everything an in-flight async call needs alive until the completion queue hands it back.
+    struct AsyncState : public AsyncCallTag
+    {
+        std::shared_ptr<RpcCall> rpc;
+        std::shared_ptr<tikvpb::Tikv::Stub> stub;
+        grpc::ClientContext context;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<S>> reader;
+        RpcCallback done;
+
+        AsyncState(std::shared_ptr<RpcCall> rpc_, std::shared_ptr<tikvpb::Tikv::Stub> stub_, RpcCallback done_)
+            : rpc(std::move(rpc_)), stub(std::move(stub_)), done(std::move(done_))
+        {}
+
+        void proceed(bool) override
+        {
+            std::unique_ptr<AsyncState> self(this);
+            rpc->setInflight(nullptr);
+            done(status.ok() && !rpc->canceled ? nullptr : rpc->errorOf(status));
+        }
+    };
+
+    static std::unique_ptr<google::protobuf::Arena> newArena()
+    {
+        google::protobuf::ArenaOptions options;
+        options.start_block_size = std::min(std::max(ArenaSizeHint<T>::value().load(std::memory_order_relaxed), arena_min_block_size), arena_max_block_size);
+        options.max_block_size = std::max(options.start_block_size, options.max_block_size);
+        return std::make_unique<google::protobuf::Arena>(options);
+    }
+
+    // The attempt timeout shrinks as the caller's deadline approaches.
+    Deadline attemptDeadline() { return std::min(std::chrono::system_clock::now() + attempt_timeout, caller_deadline); }
+
+    void applyDeadline(grpc::ClientContext & context) { context.set_deadline(attemptDeadline()); }
+
+    // A context canceled before its call starts cancels the call once started.
+    void setInflight(grpc::ClientContext * context)
+    {
+        std::lock_guard<std::mutex> lock(cancel_mutex);
+        inflight = context;
+        if (inflight != nullptr && canceled)
+            inflight->TryCancel();
+    }
+
+    std::exception_ptr errorOf(const grpc::Status & status)
+    {
+        if (canceled)
+        {
+            return std::make_exception_ptr(Exception(std::string(Trait::err_msg()) + " canceled", RequestCanceled));
+        }
+        std::string err_msg = std::string(Trait::err_msg()) + std::to_string(status.error_code()) + ": " + status.error_message();
+        log->error(err_msg);
+        // If the caller has given up, the store is not to blame and there is no point to retry.
+        if (status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED && std::chrono::system_clock::now() >= caller_deadline)
+        {
+            return std::make_exception_ptr(Exception(err_msg, DeadlineExceeded));
+        }
+        return std::make_exception_ptr(Exception(err_msg, GRPCErrorCode));
+    }
 };
 
 template <typename T>
 using RpcCallPtr = std::shared_ptr<RpcCall<T>>;
 
+struct StoreTimeout
+{
+    std::string addr;
+    RpcType type;
+    std::chrono::microseconds p99;
+    std::chrono::milliseconds timeout;
+};
+
 struct RpcClient
 {
+    using ConnMap = std::unordered_map<std::string, ConnArrayPtr>;
+
+    // Protects writers of conns.
     std::mutex mutex;
 
-    std::map<std::string, ConnArrayPtr> conns;
+    // conns is read without locking. A writer copies the current map under mutex and publishes the copy. Replaced maps are
+    // kept alive in conn_maps until the client is destroyed, it's cheap since a new map is only built for a new store.
+    std::atomic<const ConnMap *> conns;
 
-    RpcClient() {}
+    std::vector<std::unique_ptr<const ConnMap>> conn_maps;
+
+    // If enable_batch is set, requests that support it are multiplexed on BatchCommands streams.
+    const bool enable_batch;
+
+    // If adaptive_timeout is set, the timeout of an attempt is derived from the latency of the store, see StoreLatency.
+    // Otherwise it's rpc_timeout.
+    const bool adaptive_timeout;
+
+    RpcClient(bool enable_batch_ = false, bool adaptive_timeout_ = false) : enable_batch(enable_batch_), adaptive_timeout(adaptive_timeout_)
+    {
+        conn_maps.push_back(std::make_unique<const ConnMap>());
+        conns = conn_maps.back().get();
+    }
 
     ConnArrayPtr getConnArray(const std::string & addr);
 
@@ -105,9 +363,83 @@ struct RpcClient
     void sendRequest(std::string addr, RpcCallPtr<T> rpc)
     {
         ConnArrayPtr connArray = getConnArray(addr);
-        auto stub = tikvpb::Tikv::NewStub(connArray->get());
-        rpc->call(std::move(stub));
+        prepareAttempt<T>(*connArray, *rpc);
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            if constexpr (RpcTypeTraits<T>::batchable)
+            {
+                if (enable_batch)
+                {
+                    rpc->callBatch(*connArray->getBatchClient());
+                    recordLatency<T>(*connArray, start);
+                    return;
+                }
+            }
+            rpc->call(connArray->getStub().get());
+        }
+        catch (...)
+        {
+            recordLatency<T>(*connArray, start);
+            throw;
+        }
+        recordLatency<T>(*connArray, start);
+    }
+
+    template <class T>
+    void sendRequestAsync(std::string addr, RpcCallPtr<T> rpc, RpcCallback done)
+    {
+        ConnArrayPtr connArray = getConnArray(addr);
+        prepareAttempt<T>(*connArray, *rpc);
+        auto start = std::chrono::steady_clock::now();
+        rpc->callAsync(connArray->getStub(), asyncPoller().getQueue(), [connArray, start, done = std::move(done)](std::exception_ptr err) {
+            recordLatency<T>(*connArray, start);
+            done(err);
+        });
+    }
+
+    // The returned future becomes ready when the response is filled in rpc, or throws the error sendRequest would throw.
+    template <class T>
+    std::future<void> sendRequestAsync(std::string addr, RpcCallPtr<T> rpc)
+    {
+        auto promise = std::make_shared<std::promise<void>>();
+        auto future = promise->get_future();
+        sendRequestAsync(addr, rpc, [promise](std::exception_ptr err) {
+            if (err)
+                promise->set_exception(err);
+            else
+                promise->set_value();
+        });
+        return future;
     }
+
+    // asyncPoller creates the poller threads on first use, so that sync-only users don't pay for them.
+    AsyncPoller & asyncPoller();
+
+    // getStoreTimeouts returns the observed p99 latency and the current timeout of every rpc type of every known store.
+    std::vector<StoreTimeout> getStoreTimeouts();
+
+private:
+    template <class T>
+    void prepareAttempt(ConnArray & conn_array, RpcCall<T> & rpc)
+    {
+        if (adaptive_timeout)
+        {
+            rpc.setAttemptTimeout(conn_array.latency.timeout(RpcTypeTraits<T>::type, rpc_timeout));
+        }
+    }
+
+    // Failed attempts are recorded too, so that the timeout grows when a store becomes slow for all requests.
+    template <class T>
+    static void recordLatency(ConnArray & conn_array, std::chrono::steady_clock::time_point start)
+    {
+        conn_array.latency.record(
+            RpcTypeTraits<T>::type, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+    }
+
+    std::once_flag poller_flag;
+
+    std::unique_ptr<AsyncPoller> poller;
 };
 
 using RpcClientPtr = std::shared_ptr<RpcClient>;
@@ -15,8 +15,10 @@ struct Scanner
     std::string next_start_key;
     std::string end_key;
     int batch;
+    Deadline deadline;
 
-    std::vector<::kvrpcpb::KvPair> cache;
+    // The last scan response.
+    RpcCallPtr<kvrpcpb::ScanRequest> cache;
     size_t idx;
     bool valid;
     bool eof;
@@ -24,11 +26,12 @@ struct Scanner
 
     Logger * log;
 
-    Scanner(Snapshot & snapshot_, std::string start_key_, std::string end_key_, int batch_)
+    Scanner(Snapshot & snapshot_, std::string start_key_, std::string end_key_, int batch_, Deadline deadline_ = noDeadline)
         : snap(snapshot_),
           next_start_key(start_key_),
           end_key(end_key_),
           batch(batch_),
+          deadline(deadline_),
           idx(0),
           valid(true),
           eof(false),
@@ -42,18 +45,20 @@ struct Scanner
     std::string key()
     {
         if (valid)
-            return cache[idx].key();
+            return cache->getResp()->pairs(idx).key();
         return "";
     }
 
     std::string value()
     {
         if (valid)
-            return cache[idx].value();
+            return cache->getResp()->pairs(idx).value();
         return "";
     }
 
 private:
+    size_t cacheSize() { return cache == nullptr ? 0 : cache->getResp()->pairs_size(); }
+
     void getData(Backoffer & bo);
 };
 
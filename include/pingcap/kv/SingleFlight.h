@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+
+namespace pingcap
+{
+namespace kv
+{
+
+// SingleFlight makes concurrent calls with the same key share one execution. The first caller runs the function, the
+// others wait for it and get the same result or exception. A key is forgotten as soon as its call finishes, so
+// SingleFlight never caches anything.
+template <class K, class V, class Hash = std::hash<K>>
+class SingleFlight
+{
+public:
+    SingleFlight() : calls(0), shared_calls(0) {}
+
+    // run calls fn for key unless a call for key is in flight. If shared is not null, it tells if the result was shared.
+    V run(const K & key, const std::function<V()> & fn, bool * shared = nullptr)
+    {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        std::promise<V> promise;
+        std::shared_future<V> future;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = inflight.find(key);
+            if (it != inflight.end())
+            {
+                future = it->second;
+            }
+            else
+            {
+                inflight.emplace(key, promise.get_future().share());
+            }
+        }
+
+        if (shared != nullptr)
+            *shared = future.valid();
+
+        if (future.valid())
+        {
+            shared_calls.fetch_add(1, std::memory_order_relaxed);
+            return future.get();
+        }
+
+        try
+        {
+            V value = fn();
+            forget(key);
+            promise.set_value(value);
+            return value;
+        }
+        catch (...)
+        {
+            forget(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    // Number of calls, and how many of them got a shared result instead of running fn.
+    uint64_t callCount() const { return calls.load(std::memory_order_relaxed); }
+
+    uint64_t sharedCount() const { return shared_calls.load(std::memory_order_relaxed); }
+
+private:
+    void forget(const K & key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        inflight.erase(key);
+    }
+
+    std::mutex mutex;
+
+    std::unordered_map<K, std::shared_future<V>, Hash> inflight;
+
+    std::atomic<uint64_t> calls;
+
+    std::atomic<uint64_t> shared_calls;
+};
+
+} // namespace kv
+} // namespace pingcap
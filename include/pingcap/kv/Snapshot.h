@@ -1,6 +1,10 @@
 #pragma once
 
+#include <pingcap/kv/LockResolver.h>
 #include <pingcap/kv/RegionClient.h>
+#include <pingcap/kv/SingleFlight.h>
+#include <pingcap/kv/SnapshotCache.h>
+#include <pingcap/pd/Oracle.h>
 
 namespace pingcap
 {
@@ -9,17 +13,84 @@ namespace kv
 
 struct Scanner;
 
+struct KeyVersionHash
+{
+    size_t operator()(const std::pair<std::string, uint64_t> & key) const { return std::hash<std::string>()(key.first) ^ key.second; }
+};
+
+// GetSingleFlight is keyed by (key, version). Sharing a read at a fixed version is always safe because MVCC makes it
+// immutable.
+using GetSingleFlight = SingleFlight<std::pair<std::string, uint64_t>, std::string, KeyVersionHash>;
+
+using GetSingleFlightPtr = std::shared_ptr<GetSingleFlight>;
+
 struct Snapshot
 {
     RegionCachePtr cache;
     RpcClientPtr client;
     const uint64_t version;
 
-    Snapshot(RegionCachePtr cache_, RpcClientPtr client_, uint64_t ver) : cache(cache_), client(client_), version(ver) {}
+    // If hedge_delay is set, a Get that the leader hasn't answered within hedge_delay is sent again to a learner or follower
+    // as a replica read (the replica does a ReadIndex to stay consistent). The first good reply wins and the other request
+    // is canceled.
+    std::chrono::milliseconds hedge_delay;
+
+    // If get_flights is set, concurrent Gets of the same key at the same version share one rpc. Share one table among
+    // all the snapshots that may read the same keys.
+    GetSingleFlightPtr get_flights;
+
+    // If read_cache is set, Get and BatchGet answer the keys this snapshot has already read from it. Share it only
+    // among snapshots at its version, they throw LogicalError on a cache of another version.
+    SnapshotCachePtr read_cache;
+
+    // If replica_read is enabled, Get, BatchGet and Scan are served by learners or followers, falling back to the
+    // leader on error. It takes read load off the leaders, at the cost of a ReadIndex round trip on the replica.
+    ReplicaRead replica_read;
+
+    // If lock_resolver is set, reads that meet locks resolve them and retry, instead of failing with LockError.
+    LockResolverPtr lock_resolver;
+
+    Logger * log;
+
+    Snapshot(RegionCachePtr cache_, RpcClientPtr client_, uint64_t ver)
+        : cache(cache_), client(client_), version(ver), hedge_delay(0), log(&Logger::get("pingcap.tikv"))
+    {}
+
+    // boundedStaleness returns a read-only snapshot at a timestamp no older than max_staleness, taken from oracle. It
+    // costs no PD round trip while the oracle updates more often than max_staleness, but misses the writes committed
+    // within max_staleness. Meant for analytics reads that tolerate it.
+    static Snapshot boundedStaleness(
+        RegionCachePtr cache_, RpcClientPtr client_, const pd::OraclePtr & oracle, std::chrono::milliseconds max_staleness)
+    {
+        return Snapshot(cache_, client_, oracle->getStaleTimestamp(max_staleness));
+    }
+
+    // The whole read, including retries, gives up with DeadlineExceeded at deadline.
+    std::string Get(const std::string & key, Deadline deadline = noDeadline);
+
+    // BatchGet reads keys with one request per region, and the requests to different regions are in flight together.
+    // Keys that don't exist are left out of the result.
+    std::unordered_map<std::string, std::string> BatchGet(const std::vector<std::string> & keys, Deadline deadline = noDeadline);
+
+    // BatchGetValues is BatchGet with the values aligned to keys, empty for the keys that don't exist.
+    std::vector<std::string> BatchGetValues(const std::vector<std::string> & keys, Deadline deadline = noDeadline);
+
+    // deadline bounds the whole life of the scanner.
+    Scanner Scan(const std::string & begin, const std::string & end, Deadline deadline = noDeadline);
+
+private:
+    // readCache returns read_cache, or nullptr if unset. It throws if the cache is of another version.
+    SnapshotCache * readCache() const;
+
+    std::string getShared(const std::string & key, Deadline deadline);
+
+    std::string getFromTiKV(const std::string & key, Deadline deadline);
 
-    std::string Get(const std::string & key);
+    // batchGetKeys reads sorted keys into result. The keys of the requests that fail are grouped again and retried.
+    void batchGetKeys(Backoffer & bo, const std::vector<std::string_view> & keys, std::unordered_map<std::string, std::string> & result);
 
-    Scanner Scan(const std::string & begin, const std::string & end);
+    // hedgedSend returns the call that answers first, or throws what the leader request throws.
+    RpcCallPtr<kvrpcpb::GetRequest> hedgedSend(Backoffer & bo, const RegionVerID & region, RpcCallPtr<kvrpcpb::GetRequest> rpc_call);
 };
 
 } // namespace kv
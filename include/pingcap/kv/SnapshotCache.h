@@ -0,0 +1,117 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <pingcap/kv/internal/striped_counter.h>
+
+namespace pingcap
+{
+namespace kv
+{
+
+struct SnapshotCacheStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    size_t size;
+    size_t bytes;
+
+    double hitRate() const { return hits + misses == 0 ? 0 : double(hits) / (hits + misses); }
+};
+
+// SnapshotCache keeps the values read by snapshots at version. A value at a fixed version never changes, so entries are
+// only evicted, least recently used first, once the cache holds more than capacity bytes. Keys that don't exist are
+// cached as empty values. It is sharded by key, so threads reading different keys rarely share a lock.
+class SnapshotCache
+{
+    static constexpr size_t shard_count = 16;
+
+    // Charged per entry on top of the key and the value.
+    static constexpr size_t entry_overhead = 64;
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<std::pair<std::string, std::string>> lru;
+        std::unordered_map<std::string_view, std::list<std::pair<std::string, std::string>>::iterator> entries;
+        size_t bytes = 0;
+    };
+
+public:
+    SnapshotCache(uint64_t version_, size_t capacity_) : version(version_), capacity(capacity_ / shard_count) {}
+
+    // Entries are keyed by user key only, so the cache serves no snapshot at another version.
+    const uint64_t version;
+
+    bool get(const std::string & key, std::string & value)
+    {
+        Shard & shard = shardOf(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end())
+            {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                value = it->second->second;
+                hits.add();
+                return true;
+            }
+        }
+        misses.add();
+        return false;
+    }
+
+    void put(const std::string & key, const std::string & value)
+    {
+        size_t charge = key.size() + value.size() + entry_overhead;
+        if (charge > capacity)
+            return;
+        Shard & shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.entries.count(key))
+            return;
+        shard.lru.emplace_front(key, value);
+        shard.entries.emplace(shard.lru.front().first, shard.lru.begin());
+        shard.bytes += charge;
+        while (shard.bytes > capacity)
+        {
+            const auto & [old_key, old_value] = shard.lru.back();
+            shard.bytes -= old_key.size() + old_value.size() + entry_overhead;
+            shard.entries.erase(old_key);
+            shard.lru.pop_back();
+        }
+    }
+
+    SnapshotCacheStats stats()
+    {
+        SnapshotCacheStats stats{hits.load(), misses.load(), 0, 0};
+        for (auto & shard : shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.size += shard.entries.size();
+            stats.bytes += shard.bytes;
+        }
+        return stats;
+    }
+
+private:
+    Shard & shardOf(const std::string & key) { return shards[std::hash<std::string>()(key) % shard_count]; }
+
+    const size_t capacity;
+
+    Shard shards[shard_count];
+
+    StripedCounter hits;
+
+    StripedCounter misses;
+};
+
+using SnapshotCachePtr = std::shared_ptr<SnapshotCache>;
+
+} // namespace kv
+} // namespace pingcap
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <pingcap/Log.h>
+#include <pingcap/kv/Rpc.h>
+
+namespace pingcap
+{
+namespace kv
+{
+
+constexpr std::chrono::milliseconds store_probe_interval(1000);
+
+// How long a probe waits for a connection to be established.
+constexpr std::chrono::milliseconds store_probe_timeout(500);
+
+// A store is down after this many failed probes in a row.
+constexpr int store_probe_max_failures = 2;
+
+struct StoreLiveness
+{
+    std::atomic<bool> alive;
+    int failures;
+
+    StoreLiveness() : alive(true), failures(0) {}
+};
+
+using StoreLivenessPtr = std::shared_ptr<StoreLiveness>;
+
+// StoreProber watches the connectivity of the channels to the stores in the background, so a request is not sent to a
+// dead store only to wait for its timeout. A store is down if a channel to it can't connect, or not within
+// store_probe_timeout. A store is probed from the first time its liveness is asked for.
+class StoreProber
+{
+public:
+    StoreProber(RpcClientPtr client_, std::chrono::milliseconds interval_ = store_probe_interval);
+
+    ~StoreProber();
+
+    // liveness returns the state of the store at addr, it's alive until probed otherwise.
+    StoreLivenessPtr liveness(const std::string & addr);
+
+    bool isAlive(const std::string & addr) { return liveness(addr)->alive.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    void probe(const std::string & addr, StoreLiveness & liveness);
+
+    RpcClientPtr client;
+
+    const std::chrono::milliseconds interval;
+
+    std::mutex mutex;
+
+    std::unordered_map<std::string, StoreLivenessPtr> stores;
+
+    std::condition_variable cv;
+
+    bool stopped;
+
+    std::thread thread;
+
+    Logger * log;
+};
+
+using StoreProberPtr = std::shared_ptr<StoreProber>;
+
+} // namespace kv
+} // namespace pingcap
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <future>
 #include <map>
 #include <string>
 
@@ -22,14 +23,15 @@ struct Txn
 
     Buffer buffer;
 
-    int64_t start_ts;
+    Txn(ClusterPtr cluster_) : cluster(cluster_), start_ts(cluster_->pd_client->getTSAsync().share()) {}
 
-    Txn(ClusterPtr cluster_) : cluster(cluster_), start_ts(cluster_->pd_client->getTS()) {}
+    // startTS waits for the start ts on the first call. If fetching it failed, every call throws.
+    int64_t startTS() { return start_ts.get(); }
 
-    void commit()
+    void commit(Deadline deadline = noDeadline)
     {
         TwoPhaseCommitter committer(this);
-        committer.execute();
+        committer.execute(deadline);
     }
 
     void set(const std::string & key, const std::string & value) { buffer.emplace(key, value); }
@@ -41,6 +43,10 @@ struct Txn
             foo(it->first, it->second);
         }
     }
+
+private:
+    // Writes are buffered while the start ts is fetched.
+    std::shared_future<uint64_t> start_ts;
 };
 
 } // namespace kv
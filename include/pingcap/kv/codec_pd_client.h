@@ -24,6 +24,17 @@ struct CodecClient : public Client
         return std::make_pair(processRegionResult(region), leader);
     }
 
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(
+        const std::string & start_key, const std::string & end_key, int limit) override
+    {
+        auto result = Client::scanRegions(encodeBytes(start_key), encodeBytes(end_key), limit);
+        for (auto & [region, leader] : result)
+        {
+            processRegionResult(region);
+        }
+        return result;
+    }
+
     metapb::Region processRegionResult(metapb::Region & region)
     {
         region.set_start_key(decodeBytes(region.start_key()));
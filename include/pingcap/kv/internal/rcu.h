@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace pingcap
+{
+namespace kv
+{
+
+// Rcu tells a writer when no reader can still see an object it has unpublished, so that the object can be freed.
+// A reader registers in a counter of the current epoch parity. The counters are sharded by thread, so readers on
+// different cores don't bounce a shared cache line. synchronize flips the epoch and waits until the readers of the old
+// parity are gone. It must be serialized by the writers.
+class Rcu
+{
+    static constexpr size_t slot_count = 64;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<int64_t> readers[2];
+    };
+
+public:
+    class ReadGuard
+    {
+    public:
+        ReadGuard(Rcu & rcu_) : slot(rcu_.slots[slotIndex()])
+        {
+            for (;;)
+            {
+                uint64_t e = rcu_.epoch.load();
+                parity = e & 1;
+                slot.readers[parity].fetch_add(1);
+                // If the epoch has flipped meanwhile, the writer may have missed us.
+                if (rcu_.epoch.load() == e)
+                    return;
+                slot.readers[parity].fetch_sub(1);
+            }
+        }
+
+        ~ReadGuard() { slot.readers[parity].fetch_sub(1, std::memory_order_release); }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard & operator=(const ReadGuard &) = delete;
+
+    private:
+        Slot & slot;
+        size_t parity;
+    };
+
+    Rcu() : epoch(0)
+    {
+        for (auto & slot : slots)
+        {
+            slot.readers[0] = 0;
+            slot.readers[1] = 0;
+        }
+    }
+
+    void synchronize()
+    {
+        uint64_t e = epoch.load();
+        epoch.store(e + 1);
+        size_t parity = e & 1;
+        for (auto & slot : slots)
+        {
+            while (slot.readers[parity].load(std::memory_order_acquire) != 0)
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    static size_t slotIndex()
+    {
+        static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % slot_count;
+        return index;
+    }
+
+    Slot slots[slot_count];
+
+    std::atomic<uint64_t> epoch;
+};
+
+} // namespace kv
+} // namespace pingcap
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+namespace pingcap
+{
+namespace kv
+{
+
+// StripedCounter is a counter for hot paths. Threads add to different cache lines, and reads sum them up.
+class StripedCounter
+{
+    static constexpr size_t stripe_count = 16;
+
+    struct alignas(64) Stripe
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+public:
+    void add(uint64_t n = 1) { stripes[stripeIndex()].value.fetch_add(n, std::memory_order_relaxed); }
+
+    uint64_t load() const
+    {
+        uint64_t sum = 0;
+        for (const auto & stripe : stripes)
+            sum += stripe.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+
+private:
+    static size_t stripeIndex()
+    {
+        static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % stripe_count;
+        return index;
+    }
+
+    Stripe stripes[stripe_count];
+};
+
+} // namespace kv
+} // namespace pingcap
@@ -8,30 +8,101 @@ namespace pingcap
 namespace kv
 {
 
+enum RpcType
+{
+    rpcSplitRegion = 0,
+    rpcCommit,
+    rpcPrewrite,
+    rpcScan,
+    rpcGet,
+    rpcReadIndex,
+    rpcBatchGet,
+    rpcCheckTxnStatus,
+    rpcResolveLock,
+    rpcTypeCount
+};
+
+inline const char * rpcTypeName(RpcType type)
+{
+    switch (type)
+    {
+        case rpcSplitRegion:
+            return "SplitRegion";
+        case rpcCommit:
+            return "Commit";
+        case rpcPrewrite:
+            return "Prewrite";
+        case rpcScan:
+            return "Scan";
+        case rpcGet:
+            return "Get";
+        case rpcReadIndex:
+            return "ReadIndex";
+        case rpcBatchGet:
+            return "BatchGet";
+        case rpcCheckTxnStatus:
+            return "CheckTxnStatus";
+        case rpcResolveLock:
+            return "ResolveLock";
+        case rpcTypeCount:
+            break;
+    }
+    return "Unknown";
+}
+
 template <class T>
 struct RpcTypeTraits
 {
 };
 
-#define PINGCAP_DEFINE_TRAITS(NAME, METHOD) \
-template<> struct RpcTypeTraits<::kvrpcpb::NAME##Request> \
-{ \
+#define PINGCAP_DEFINE_TRAITS_COMMON(NAME, METHOD) \
     using RequestType = ::kvrpcpb::NAME##Request; \
     using ResultType = ::kvrpcpb::NAME##Response; \
+    static constexpr RpcType type = rpc##NAME; \
     static const char * err_msg() { return #NAME" Failed"; } \
     static ::grpc::Status doRPCCall( \
-        grpc::ClientContext * context, std::unique_ptr<tikvpb::Tikv::Stub> stub, const RequestType & req, ResultType * res) \
+        grpc::ClientContext * context, tikvpb::Tikv::Stub * stub, const RequestType & req, ResultType * res) \
     {\
         return stub->METHOD(context, req, res); \
     }\
+    static std::unique_ptr<grpc::ClientAsyncResponseReader<ResultType>> doAsyncRPCCall( \
+        grpc::ClientContext * context, tikvpb::Tikv::Stub * stub, const RequestType & req, grpc::CompletionQueue * cq) \
+    {\
+        return stub->PrepareAsync##METHOD(context, req, cq); \
+    }
+
+#define PINGCAP_DEFINE_TRAITS(NAME, METHOD) \
+template<> struct RpcTypeTraits<::kvrpcpb::NAME##Request> \
+{ \
+    PINGCAP_DEFINE_TRAITS_COMMON(NAME, METHOD) \
+    static constexpr bool batchable = false; \
+};
+
+// Requests that can be multiplexed on a BatchCommands stream, CMD is the name of their field in the batch request oneof.
+#define PINGCAP_DEFINE_BATCH_TRAITS(NAME, METHOD, CMD) \
+template<> struct RpcTypeTraits<::kvrpcpb::NAME##Request> \
+{ \
+    PINGCAP_DEFINE_TRAITS_COMMON(NAME, METHOD) \
+    static constexpr bool batchable = true; \
+    static void toBatch(const RequestType & req, tikvpb::BatchCommandsRequest::Request * batch_req) \
+    {\
+        batch_req->mutable_##CMD()->CopyFrom(req); \
+    }\
+    static void fromBatch(tikvpb::BatchCommandsResponse::Response * batch_res, ResultType * res) \
+    {\
+        res->Swap(batch_res->mutable_##CMD()); \
+    }\
 };
 
 PINGCAP_DEFINE_TRAITS(SplitRegion, SplitRegion)
-PINGCAP_DEFINE_TRAITS(Commit, KvCommit)
-PINGCAP_DEFINE_TRAITS(Prewrite, KvPrewrite)
-PINGCAP_DEFINE_TRAITS(Scan, KvScan)
-PINGCAP_DEFINE_TRAITS(Get, KvGet)
+PINGCAP_DEFINE_BATCH_TRAITS(Commit, KvCommit, commit)
+PINGCAP_DEFINE_BATCH_TRAITS(Prewrite, KvPrewrite, prewrite)
+PINGCAP_DEFINE_BATCH_TRAITS(Scan, KvScan, scan)
+PINGCAP_DEFINE_BATCH_TRAITS(Get, KvGet, get)
 PINGCAP_DEFINE_TRAITS(ReadIndex, ReadIndex)
+PINGCAP_DEFINE_BATCH_TRAITS(BatchGet, KvBatchGet, batchget)
+PINGCAP_DEFINE_BATCH_TRAITS(CheckTxnStatus, KvCheckTxnStatus, checktxnstatus)
+PINGCAP_DEFINE_BATCH_TRAITS(ResolveLock, KvResolveLock, resolvelock)
 
 } // namespace kv
 } // namespace pingcap
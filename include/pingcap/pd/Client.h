@@ -3,6 +3,8 @@
 #include <kvproto/pdpb.grpc.pb.h>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <future>
 #include <mutex>
 #include <shared_mutex>
 #include <thread>
@@ -15,6 +17,19 @@ namespace pingcap
 namespace pd
 {
 
+// Upper bound of the timestamps fetched by one Tso request.
+constexpr size_t tso_max_batch_size = 10000;
+
+// Cumulative counters of the TSO dispatcher. Average batch size is
+// requests / batches, average wait is wait_us / requests.
+struct TSOStats
+{
+    uint64_t requests;
+    uint64_t batches;
+    uint64_t max_batch_size;
+    uint64_t wait_us;
+};
+
 struct SecurityOption
 {
     std::string CAPath;
@@ -28,7 +43,9 @@ class Client : public IClient
 
     const std::chrono::seconds pd_timeout;
 
-    const std::chrono::microseconds loop_interval;
+    // Minimum gap between two leader updates, so that a PD outage doesn't turn
+    // every failed request into another round of GetMembers.
+    const std::chrono::milliseconds update_leader_retry_interval;
 
     const std::chrono::seconds update_leader_interval;
 
@@ -39,18 +56,26 @@ public:
 
     //uint64_t getClusterID() override;
 
-    // only implement a weak get ts.
+    // Concurrent callers are batched into one request on a persistent Tso stream.
     uint64_t getTS() override;
 
+    // The wait of get() is bounded by pd_timeout like getTS().
+    std::future<uint64_t> getTSAsync() override;
+
+    TSOStats getTSOStats() const;
+
     std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string & key) override;
 
     //std::pair<metapb::Region, metapb::Peer> getPrevRegion(std::string key) override;
 
     std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t region_id) override;
 
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(
+        const std::string & start_key, const std::string & end_key, int limit) override;
+
     metapb::Store getStore(uint64_t store_id) override;
 
-    //std::vector<metapb::Store> getAllStores() override;
+    std::vector<metapb::Store> getAllStores() override;
 
     uint64_t getGCSafePoint() override;
 
@@ -65,17 +90,39 @@ private:
 
     void leaderLoop();
 
+    // Wakes up the leader loop to refresh the leader.
+    void asyncUpdateLeader();
+
     void switchLeader(const ::google::protobuf::RepeatedPtrField<std::string> &);
 
-    std::unique_ptr<pdpb::PD::Stub> leaderStub();
+    std::shared_ptr<pdpb::PD::Stub> leaderStub();
 
     pdpb::GetMembersResponse getMembers(std::string);
 
+    struct TSORequest
+    {
+        std::promise<uint64_t> promise;
+        std::chrono::steady_clock::time_point enqueue_time;
+    };
+
+    using TSORequestPtr = std::shared_ptr<TSORequest>;
+
+    void tsoLoop();
+
+    // Fetches `count` consecutive timestamps, returns the first one.
+    uint64_t fetchTSBatch(uint32_t count);
+
+    // Tears down the stream, returns its final status. Dispatcher thread only.
+    grpc::Status resetTSOStream();
+
+    void cancelTSOStream();
+
     pdpb::RequestHeader * requestHeader();
 
     std::shared_ptr<grpc::Channel> getOrCreateGRPCConn(const std::string &);
 
-    std::unique_ptr<pdpb::PD::Stub> stub_ptr;
+    // Stub of the current leader, replaced with std::atomic_store on leader change.
+    std::shared_ptr<pdpb::PD::Stub> leader_stub;
 
     std::shared_mutex leader_mutex;
 
@@ -91,13 +138,42 @@ private:
 
     std::string leader;
 
-    std::atomic<bool> work_threads_stop;
+    std::atomic<bool> work_threads_stop{false};
 
     std::thread work_thread;
 
     std::condition_variable update_leader_cv;
 
-    std::atomic<bool> check_leader;
+    std::atomic<bool> check_leader{false};
+
+    // The TSO dispatcher. Only tso_thread touches the stream; tso_mutex guards
+    // the queue and the context, so timed out callers can cancel a stuck read.
+    std::mutex tso_mutex;
+
+    std::condition_variable tso_cv;
+
+    std::deque<TSORequestPtr> tso_queue;
+
+    bool tso_stop = false;
+
+    std::thread tso_thread;
+
+    std::shared_ptr<pdpb::PD::Stub> tso_stub;
+
+    std::unique_ptr<grpc::ClientContext> tso_context;
+
+    std::unique_ptr<grpc::ClientReaderWriter<pdpb::TsoRequest, pdpb::TsoResponse>> tso_stream;
+
+    // Set when the leader changes, the stream is reopened before the next batch.
+    std::atomic<bool> tso_stream_stale{false};
+
+    std::atomic<uint64_t> tso_requests{0};
+
+    std::atomic<uint64_t> tso_batches{0};
+
+    std::atomic<uint64_t> tso_max_batch{0};
+
+    std::atomic<uint64_t> tso_wait_us{0};
 
     Logger * log;
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <future>
 #include <string>
 #include <vector>
 
@@ -22,6 +23,10 @@ public:
 
     virtual uint64_t getTS() = 0;
 
+    // Starts fetching a timestamp and returns without waiting for it.
+    // get() on the result blocks until it is available or throws on failure.
+    virtual std::future<uint64_t> getTSAsync() = 0;
+
     // return region meta and leader peer.
     virtual std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string & key) = 0;
 
@@ -30,9 +35,16 @@ public:
     // return region meta and leader peer.
     virtual std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t region_id) = 0;
 
+    // return at most limit regions and their leaders from the one containing start_key, stopping before end_key.
+    // An empty end_key means no end.
+    virtual std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(
+        const std::string & start_key, const std::string & end_key, int limit)
+        = 0;
+
     virtual metapb::Store getStore(uint64_t store_id) = 0;
 
-    //    virtual std::vector<metapb::Store> getAllStores() = 0;
+    // return all the stores except the tombstone ones.
+    virtual std::vector<metapb::Store> getAllStores() = 0;
 
     virtual uint64_t getGCSafePoint() = 0;
 
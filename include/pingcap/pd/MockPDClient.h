@@ -1,5 +1,6 @@
 #pragma once
 
+#include <pingcap/Exception.h>
 #include <pingcap/pd/IClient.h>
 #include <limits>
 
@@ -21,12 +22,27 @@ public:
 
     uint64_t getTS() override { return Clock::now().time_since_epoch().count(); }
 
+    std::future<uint64_t> getTSAsync() override
+    {
+        std::promise<uint64_t> ts;
+        ts.set_value(getTS());
+        return ts.get_future();
+    }
+
     std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string &) override { throw "not implemented"; }
 
     std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t) override { throw "not implemented"; }
 
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(const std::string &, const std::string &, int) override
+    {
+        throw "not implemented";
+    }
+
     metapb::Store getStore(uint64_t) override { throw "not implemented"; }
 
+    // Throws an Exception, which the store refresher expects from a failed load.
+    std::vector<metapb::Store> getAllStores() override { throw Exception("not implemented", LogicalError); }
+
     bool isMock() override { return true; }
 };
 
@@ -26,6 +26,9 @@ class Oracle
 
     std::atomic<uint64_t> last_ts;
 
+    // Local steady clock time in ms when last_ts was fetched. It doesn't depend on the clocks of PD and us agreeing.
+    std::atomic<int64_t> last_update_ms;
+
     std::thread work_thread;
     std::chrono::milliseconds update_interval;
 
@@ -34,8 +37,9 @@ public:
         : pd_client(pd_client_), update_interval(update_interval_), log(&Logger::get("pd/oracle"))
     {
         quit = false;
-        work_thread = std::thread([&]() { updateTS(update_interval); });
         last_ts = 0;
+        last_update_ms = 0;
+        work_thread = std::thread([&]() { updateTS(update_interval); });
     }
 
     ~Oracle() { close(); }
@@ -43,14 +47,54 @@ public:
     void close()
     {
         quit = true;
-        work_thread.join();
+        if (work_thread.joinable())
+            work_thread.join();
     }
 
     int64_t untilExpired(uint64_t lock_ts, uint64_t ttl) { return extractPhysical(lock_ts) + ttl - extractPhysical(last_ts); }
 
     uint64_t getLowResolutionTimestamp() { return last_ts; }
 
+    // getStaleTimestamp returns a timestamp at most max_staleness old. It is served from the background updated one
+    // when that is fresh enough, so with update_interval below max_staleness it rarely costs a PD round trip.
+    uint64_t getStaleTimestamp(std::chrono::milliseconds max_staleness)
+    {
+        // Read the time first, a concurrent update can only make the timestamp fresher.
+        int64_t updated = last_update_ms.load();
+        uint64_t ts = last_ts.load();
+        if (ts != 0 && nowMs() - updated <= max_staleness.count())
+        {
+            return ts;
+        }
+        int64_t fetch_start = nowMs();
+        ts = pd_client->getTS();
+        advance(ts, fetch_start);
+        return ts;
+    }
+
 private:
+    static int64_t nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // advance publishes ts fetched at fetch_start unless a newer one is already there.
+    void advance(uint64_t ts, int64_t fetch_start)
+    {
+        uint64_t old_ts = last_ts.load();
+        while (old_ts < ts)
+        {
+            if (last_ts.compare_exchange_weak(old_ts, ts))
+            {
+                // The ts is no older than the start of its fetch.
+                int64_t old_update = last_update_ms.load();
+                while (old_update < fetch_start && !last_update_ms.compare_exchange_weak(old_update, fetch_start))
+                    ;
+                return;
+            }
+        }
+    }
+
     void updateTS(std::chrono::milliseconds update_interval)
     {
         for (;;)
@@ -61,7 +105,8 @@ private:
             }
             try
             {
-                last_ts = pd_client->getTS();
+                int64_t fetch_start = nowMs();
+                advance(pd_client->getTS(), fetch_start);
             }
             catch (Exception & e)
             {
@@ -16,20 +16,23 @@ TwoPhaseCommitter::TwoPhaseCommitter(Txn * txn)
         mutations.emplace(key, value);
     });
     cluster = txn->cluster;
-    start_ts = txn->start_ts;
+    start_ts = txn->startTS();
     primary_lock = keys[0];
 }
 
-void TwoPhaseCommitter::execute()
+void TwoPhaseCommitter::execute(Deadline deadline)
 {
     try
     {
-        Backoffer prewrite_bo(prewriteMaxBackoff);
-        prewriteKeys(prewrite_bo, keys);
-        commit_ts = cluster->pd_client->getTS();
+        Backoffer prewrite_bo(prewriteMaxBackoff, deadline);
+        prewriteKeys(prewrite_bo, 0, keys.size());
+        // The commit ts must be fetched after the prewrite, but grouping the keys does not need it.
+        auto commit_ts_future = cluster->pd_client->getTSAsync();
+        Backoffer commit_bo(commitMaxBackoff, deadline);
+        std::vector<BatchKeys> commit_batches = groupKeys(commit_bo, 0, keys.size());
+        commit_ts = commit_ts_future.get();
         // TODO: check expired
-        Backoffer commit_bo(commitMaxBackoff);
-        commitKeys(commit_bo, keys);
+        doActionOnBatchGroups<ActionCommit>(commit_bo, std::move(commit_batches));
         // TODO: Process commit exception
     }
     catch (Exception & e)
@@ -44,9 +47,11 @@ void TwoPhaseCommitter::execute()
 
 void TwoPhaseCommitter::prewriteSingleBatch(Backoffer & bo, const BatchKeys & batch)
 {
-    auto req = new kvrpcpb::PrewriteRequest();
-    for (const std::string & key : batch.keys)
+    auto rpc_call = std::make_shared<RpcCall<kvrpcpb::PrewriteRequest>>();
+    auto req = rpc_call->getReq();
+    for (size_t i = batch.begin; i < batch.end; i++)
     {
+        const std::string & key = keys[i];
         auto * mut = req->add_mutations();
         mut->set_key(key);
         mut->set_value(mutations[key]);
@@ -58,7 +63,6 @@ void TwoPhaseCommitter::prewriteSingleBatch(Backoffer & bo, const BatchKeys & ba
     req->set_txn_size(500);
     req->set_primary_lock(primary_lock);
 
-    auto rpc_call = std::make_shared<pingcap::kv::RpcCall<kvrpcpb::PrewriteRequest>>(req);
     RegionClient region_client(cluster->region_cache, cluster->rpc_client, batch.region);
     for (;;)
     {
@@ -70,7 +74,7 @@ void TwoPhaseCommitter::prewriteSingleBatch(Backoffer & bo, const BatchKeys & ba
         {
             // Region Error.
             bo.backoff(boRegionMiss, e);
-            prewriteKeys(bo, batch.keys);
+            prewriteKeys(bo, batch.begin, batch.end);
             return;
         }
 
@@ -78,8 +82,16 @@ void TwoPhaseCommitter::prewriteSingleBatch(Backoffer & bo, const BatchKeys & ba
 
         if (res->errors_size() != 0)
         {
-            // TODO resolve lock and retry
-            throw Exception("meet lock error", LockError);
+            std::vector<Lock> locks;
+            for (const auto & err : res->errors())
+            {
+                if (!err.has_locked())
+                    throw Exception("meet key error", LockError);
+                locks.emplace_back(err.locked());
+            }
+            if (cluster->lock_resolver->resolveLocks(bo, start_ts, locks) > 0)
+                bo.backoff(boTxnLock, Exception("prewrite meets locks", LockError));
+            continue;
         }
 
         return;
@@ -88,15 +100,15 @@ void TwoPhaseCommitter::prewriteSingleBatch(Backoffer & bo, const BatchKeys & ba
 
 void TwoPhaseCommitter::commitSingleBatch(Backoffer & bo, const BatchKeys & batch)
 {
-    auto req = new kvrpcpb::CommitRequest();
-    for (const auto & key : batch.keys)
+    auto rpc_call = std::make_shared<RpcCall<kvrpcpb::CommitRequest>>();
+    auto req = rpc_call->getReq();
+    for (size_t i = batch.begin; i < batch.end; i++)
     {
-        req->add_keys(key);
+        req->add_keys(keys[i]);
     }
     req->set_start_version(start_ts);
     req->set_commit_version(commit_ts);
 
-    auto rpc_call = std::make_shared<pingcap::kv::RpcCall<kvrpcpb::CommitRequest>>(req);
     RegionClient region_client(cluster->region_cache, cluster->rpc_client, batch.region);
     try
     {
@@ -105,7 +117,7 @@ void TwoPhaseCommitter::commitSingleBatch(Backoffer & bo, const BatchKeys & batc
     catch (Exception & e)
     {
         bo.backoff(boRegionMiss, e);
-        commitKeys(bo, batch.keys);
+        commitKeys(bo, batch.begin, batch.end);
         return;
     }
     auto * res = rpc_call->getResp();
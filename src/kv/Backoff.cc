@@ -50,7 +50,7 @@ Exception Type2Exception(BackoffType tp)
 
 void Backoffer::backoff(BackoffType tp, const Exception & exc)
 {
-    if (exc.code() == MismatchClusterIDCode)
+    if (exc.code() == MismatchClusterIDCode || exc.code() == DeadlineExceeded)
     {
         exc.rethrow();
     }
@@ -66,12 +66,23 @@ void Backoffer::backoff(BackoffType tp, const Exception & exc)
         bo = newBackoff(tp);
         backoff_map[tp] = bo;
     }
-    total_sleep += bo->sleep();
+    int sleep_time = bo->nextSleep();
+    total_sleep += sleep_time;
     if (max_sleep > 0 && total_sleep > max_sleep)
     {
         // TODO:: Should Record all the errors!!
         throw exc;
     }
+    if (deadline != noDeadline && std::chrono::system_clock::now() + std::chrono::milliseconds(sleep_time) >= deadline)
+    {
+        throw Exception("deadline exceeded, last error: " + exc.displayText(), DeadlineExceeded);
+    }
+    if (defer_sleep && pending_sleep == 0)
+    {
+        pending_sleep = sleep_time;
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(sleep_time));
 }
 
 } // namespace kv
@@ -0,0 +1,163 @@
+#include <pingcap/kv/BatchCommands.h>
+
+namespace pingcap
+{
+namespace kv
+{
+
+BatchCommandsClient::BatchCommandsClient(std::shared_ptr<grpc::Channel> channel)
+    : stub(tikvpb::Tikv::NewStub(channel)), next_id(0), stopped(false), broken(false), log(&Logger::get("pingcap.tikv"))
+{
+    send_thread = std::thread([this]() { sendLoop(); });
+}
+
+BatchCommandsClient::~BatchCommandsClient()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    cv.notify_all();
+    send_thread.join();
+    resetStream();
+}
+
+tikvpb::BatchCommandsResponse::Response BatchCommandsClient::send(
+    tikvpb::BatchCommandsRequest::Request && req, std::chrono::system_clock::time_point deadline)
+{
+    EntryPtr entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry = std::make_shared<Entry>(next_id++, std::move(req));
+        queue.push_back(entry);
+    }
+    cv.notify_one();
+
+    auto future = entry->promise.get_future();
+    if (future.wait_until(deadline) == std::future_status::timeout)
+    {
+        entry->canceled = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.erase(entry->id);
+        }
+        std::string err_msg = "batch commands request " + std::to_string(entry->id) + " timeout";
+        log->error(err_msg);
+        throw Exception(err_msg, GRPCErrorCode);
+    }
+    future.get();
+    return std::move(entry->resp);
+}
+
+void BatchCommandsClient::connect()
+{
+    context = std::make_unique<grpc::ClientContext>();
+    stream = stub->BatchCommands(context.get());
+    broken = false;
+    recv_thread = std::thread([this, s = stream.get()]() { recvLoop(s); });
+}
+
+// resetStream must be called without holding mutex, because the receive thread takes it when the stream is closed.
+void BatchCommandsClient::resetStream()
+{
+    if (stream == nullptr)
+        return;
+    context->TryCancel();
+    recv_thread.join();
+    auto status = stream->Finish();
+    log->warning("batch commands stream closed: " + std::to_string(status.error_code()) + ": " + status.error_message());
+    stream.reset();
+    context.reset();
+}
+
+void BatchCommandsClient::sendLoop()
+{
+    for (;;)
+    {
+        bool need_reset = false;
+        tikvpb::BatchCommandsRequest batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return stopped || broken || !queue.empty(); });
+            if (stopped)
+            {
+                // Nobody will send the queued requests, so their callers must not wait for their deadlines.
+                for (auto & entry : queue)
+                {
+                    if (!entry->canceled)
+                        entry->promise.set_exception(std::make_exception_ptr(Exception("batch commands client is stopped", GRPCErrorCode)));
+                }
+                queue.clear();
+                return;
+            }
+            need_reset = broken;
+            if (!need_reset)
+            {
+                if (stream == nullptr)
+                    connect();
+
+                while (!queue.empty() && size_t(batch.requests_size()) < batch_commands_max_size)
+                {
+                    EntryPtr entry = queue.front();
+                    queue.pop_front();
+                    if (entry->canceled)
+                        continue;
+                    batch.add_request_ids(entry->id);
+                    batch.add_requests()->Swap(&entry->req);
+                    pending.emplace(entry->id, entry);
+                }
+            }
+        }
+
+        if (need_reset)
+        {
+            resetStream();
+            // The stream is connected again by the next batch.
+            std::lock_guard<std::mutex> lock(mutex);
+            broken = false;
+            continue;
+        }
+
+        if (batch.requests_size() > 0 && !stream->Write(batch))
+        {
+            // The receive thread will see the stream closed and fail the pending requests.
+            log->warning("write batch commands failed");
+            context->TryCancel();
+        }
+    }
+}
+
+void BatchCommandsClient::recvLoop(Stream * stream)
+{
+    tikvpb::BatchCommandsResponse batch;
+    while (stream->Read(&batch))
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < batch.request_ids_size() && i < batch.responses_size(); i++)
+        {
+            auto it = pending.find(batch.request_ids(i));
+            if (it == pending.end())
+            {
+                // The caller has given up.
+                continue;
+            }
+            EntryPtr entry = it->second;
+            pending.erase(it);
+            entry->resp.Swap(batch.mutable_responses(i));
+            entry->promise.set_value();
+        }
+    }
+
+    // The stream is finished by the send thread, as Finish must not race with Write.
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto & it : pending)
+    {
+        it.second->promise.set_exception(std::make_exception_ptr(Exception("batch commands stream is broken", GRPCErrorCode)));
+    }
+    pending.clear();
+    broken = true;
+    cv.notify_one();
+}
+
+} // namespace kv
+} // namespace pingcap
@@ -0,0 +1,135 @@
+#include <pingcap/kv/LockResolver.h>
+#include <pingcap/pd/Oracle.h>
+
+namespace pingcap
+{
+namespace kv
+{
+
+int64_t LockResolver::resolveLocks(Backoffer & bo, uint64_t caller_start_ts, const std::vector<Lock> & locks)
+{
+    uint64_t current_ts = 0;
+    int64_t before_expired = 0;
+    std::unordered_map<uint64_t, std::unordered_set<RegionVerID>> cleaned_regions;
+    for (const auto & lock : locks)
+    {
+        TxnStatus status;
+        if (!getResolved(lock.txn_id, status))
+        {
+            if (current_ts == 0)
+                current_ts = pd_client->getTS();
+            status = getTxnStatus(bo, lock, caller_start_ts, current_ts);
+        }
+
+        if (status.ttl == 0)
+        {
+            resolveLock(bo, lock, status, cleaned_regions[lock.txn_id]);
+            continue;
+        }
+        int64_t ms = pd::extractPhysical(lock.txn_id) + int64_t(status.ttl) - pd::extractPhysical(current_ts);
+        ms = std::max<int64_t>(ms, 1);
+        before_expired = before_expired == 0 ? ms : std::min(before_expired, ms);
+    }
+    return before_expired;
+}
+
+TxnStatus LockResolver::getTxnStatus(Backoffer & bo, const Lock & lock, uint64_t caller_start_ts, uint64_t current_ts)
+{
+    // Until the lock expires its primary may just not be prewritten yet, so it must not be rolled back if missing.
+    bool expired = pd::extractPhysical(lock.txn_id) + int64_t(lock.ttl) <= pd::extractPhysical(current_ts);
+    for (;;)
+    {
+        auto loc = cache->locateKey(bo, lock.primary);
+        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::CheckTxnStatusRequest>>();
+        auto * req = rpc_call->getReq();
+        req->set_primary_key(lock.primary);
+        req->set_lock_ts(lock.txn_id);
+        req->set_caller_start_ts(caller_start_ts);
+        req->set_current_ts(current_ts);
+        req->set_rollback_if_not_exist(expired);
+
+        try
+        {
+            RegionClient(cache, client, loc.region).sendReqToRegion(bo, rpc_call);
+        }
+        catch (Exception & e)
+        {
+            cache->dropRegion(loc.region);
+            bo.backoff(boRegionMiss, e);
+            continue;
+        }
+
+        auto * resp = rpc_call->getResp();
+        if (resp->has_error())
+        {
+            if (!expired)
+                return TxnStatus{lock.ttl, 0};
+            throw Exception("check txn status failed: " + resp->error().ShortDebugString(), LockError);
+        }
+
+        TxnStatus status{resp->lock_ttl(), resp->commit_version()};
+        if (status.ttl == 0)
+            saveResolved(lock.txn_id, status);
+        return status;
+    }
+}
+
+void LockResolver::resolveLock(Backoffer & bo, const Lock & lock, const TxnStatus & status, std::unordered_set<RegionVerID> & cleaned_regions)
+{
+    for (;;)
+    {
+        auto loc = cache->locateKey(bo, lock.key);
+        if (cleaned_regions.count(loc.region))
+            return;
+
+        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::ResolveLockRequest>>();
+        auto * req = rpc_call->getReq();
+        req->set_start_version(lock.txn_id);
+        req->set_commit_version(status.commit_ts);
+
+        try
+        {
+            RegionClient(cache, client, loc.region).sendReqToRegion(bo, rpc_call);
+        }
+        catch (Exception & e)
+        {
+            cache->dropRegion(loc.region);
+            bo.backoff(boRegionMiss, e);
+            continue;
+        }
+
+        auto * resp = rpc_call->getResp();
+        if (resp->has_error())
+            throw Exception("resolve lock failed: " + resp->error().ShortDebugString(), LockError);
+
+        log->debug("resolved locks of txn " + std::to_string(lock.txn_id) + " in region " + std::to_string(loc.region.id));
+        cleaned_regions.insert(loc.region);
+        return;
+    }
+}
+
+bool LockResolver::getResolved(uint64_t txn_id, TxnStatus & status)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = resolved.find(txn_id);
+    if (it == resolved.end())
+        return false;
+    status = it->second;
+    return true;
+}
+
+void LockResolver::saveResolved(uint64_t txn_id, const TxnStatus & status)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!resolved.emplace(txn_id, status).second)
+        return;
+    resolved_order.push_back(txn_id);
+    if (resolved_order.size() > resolved_txn_cache_size)
+    {
+        resolved.erase(resolved_order.front());
+        resolved_order.pop_front();
+    }
+}
+
+} // namespace kv
+} // namespace pingcap
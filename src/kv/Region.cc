@@ -1,22 +1,105 @@
 #include <pingcap/Exception.h>
 #include <pingcap/kv/Region.h>
+#include <pingcap/kv/StoreProber.h>
+
+#include <algorithm>
+#include <future>
 
 namespace pingcap
 {
 namespace kv
 {
 
+RegionIndex::RegionIndex(const std::map<std::string, RegionPtr> & regions_map, const std::unordered_map<RegionVerID, RegionPtr> & regions)
+{
+    auto begin = regions_map.begin();
+    // An empty end key sorts first in the map but means the end of the key space.
+    if (begin != regions_map.end() && begin->first.empty())
+    {
+        last = begin->second;
+        ++begin;
+    }
+    if (begin != regions_map.end())
+    {
+        // The keys are sorted, so the common prefix of all is that of the first and the last.
+        const std::string & first_key = begin->first;
+        const std::string & last_key = regions_map.rbegin()->first;
+        auto mismatch = std::mismatch(first_key.begin(), first_key.end(), last_key.begin(), last_key.end());
+        prefix.assign(first_key.begin(), mismatch.first);
+    }
+    offsets.reserve(regions_map.size() + 1);
+    by_end_key.reserve(regions_map.size());
+    offsets.push_back(0);
+    for (auto it = begin; it != regions_map.end(); ++it)
+    {
+        suffixes.append(it->first, prefix.size(), std::string::npos);
+        offsets.push_back(suffixes.size());
+        by_end_key.push_back(it->second);
+    }
+
+    by_id.assign(regions.begin(), regions.end());
+    std::sort(by_id.begin(), by_id.end(), [](const auto & lhs, const auto & rhs) { return lhs.first < rhs.first; });
+}
+
+size_t RegionIndex::upperBound(std::string_view key) const
+{
+    // Every end key starts with prefix, so only a key starting with it needs the suffixes compared.
+    size_t n = std::min(key.size(), prefix.size());
+    int cmp = key.compare(0, n, prefix, 0, n);
+    if (cmp < 0 || (cmp == 0 && n < prefix.size()))
+        return 0;
+    if (cmp > 0)
+        return by_end_key.size();
+    std::string_view suffix = key.substr(prefix.size());
+    size_t lo = 0, hi = by_end_key.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (endKeySuffix(mid) > suffix)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+RegionPtr RegionIndex::search(std::string_view key) const
+{
+    size_t i = upperBound(key);
+    if (i < by_end_key.size() && by_end_key[i]->contains(key))
+    {
+        return by_end_key[i];
+    }
+    if (last != nullptr && last->contains(key))
+    {
+        return last;
+    }
+    return nullptr;
+}
+
+RegionPtr RegionIndex::getByID(const RegionVerID & id) const
+{
+    auto it = std::lower_bound(by_id.begin(), by_id.end(), id, [](const auto & entry, const RegionVerID & id) { return entry.first < id; });
+    if (it != by_id.end() && it->first == id)
+    {
+        return it->second;
+    }
+    return nullptr;
+}
+
 RPCContextPtr RegionCache::getRPCContext(Backoffer & bo, const RegionVerID & id)
 {
     for (;;)
     {
         RegionPtr region = getRegionByID(bo, id);
-        const auto & meta = region->meta;
-        auto peer = region->peer;
-
-        std::string addr = getStore(bo, peer.store_id()).addr;
-        if (addr == "")
+        RPCContextPtr ctx = std::atomic_load(&region->rpc_ctx);
+        if (ctx == nullptr || ctx->store_epoch != store_epoch.load(std::memory_order_acquire))
         {
+            ctx = buildRPCContext(bo, region);
+        }
+        if (ctx == nullptr)
+        {
+            const auto & peer = region->peer;
             dropRegion(id);
             dropStore(peer.store_id());
             bo.backoff(boRegionMiss,
@@ -24,24 +107,210 @@ RPCContextPtr RegionCache::getRPCContext(Backoffer & bo, const RegionVerID & id)
                     StoreNotReady));
             continue;
         }
-        return std::make_shared<RPCContext>(id, meta, peer, addr);
+        if (!isStoreAlive(*ctx))
+        {
+            // A follower on a live store either serves as the new leader or tells who is.
+            RPCContextPtr alternate = getAlternateRPCContext(bo, region);
+            if (alternate != nullptr)
+            {
+                return alternate;
+            }
+            bo.backoff(boTiKVRPC, Exception("store " + ctx->addr + " of region " + std::to_string(id.id) + " is unreachable", StoreNotReady));
+            continue;
+        }
+        return ctx;
+    }
+}
+
+bool RegionCache::isStoreAlive(const RPCContext & ctx) const
+{
+    return ctx.liveness == nullptr || ctx.liveness->alive.load(std::memory_order_relaxed);
+}
+
+RPCContextPtr RegionCache::getAlternateRPCContext(Backoffer & bo, const RegionPtr & region)
+{
+    uint64_t epoch = store_epoch.load(std::memory_order_acquire);
+    for (int i = 0; i < region->meta.peers_size(); i++)
+    {
+        const auto & peer = region->meta.peers(i);
+        if (peer.is_learner() || peer.store_id() == region->peer.store_id())
+        {
+            continue;
+        }
+        std::string addr = getStore(bo, peer.store_id()).addr;
+        if (addr == "")
+        {
+            continue;
+        }
+        auto ctx = std::make_shared<RPCContext>(region->verID(), region->meta, peer, addr, epoch, store_prober->liveness(addr));
+        if (isStoreAlive(*ctx))
+        {
+            return ctx;
+        }
     }
+    return nullptr;
+}
+
+RPCContextPtr RegionCache::buildRPCContext(Backoffer & bo, const RegionPtr & region)
+{
+    // Read the epoch before the store, a drop in between makes the context be built again next time.
+    uint64_t epoch = store_epoch.load(std::memory_order_acquire);
+    std::string addr = getStore(bo, region->peer.store_id()).addr;
+    if (addr == "")
+    {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(region->rpc_ctx_mutex);
+    RPCContextPtr ctx = std::atomic_load(&region->rpc_ctx);
+    if (ctx != nullptr && ctx->store_epoch == epoch)
+    {
+        return ctx;
+    }
+    auto liveness = store_prober != nullptr ? store_prober->liveness(addr) : nullptr;
+    ctx = std::make_shared<RPCContext>(region->verID(), region->meta, region->peer, addr, epoch, liveness);
+    std::atomic_store(&region->rpc_ctx, ctx);
+    return ctx;
+}
+
+bool RegionCache::isFresh(const ReplicaContexts & replicas) const
+{
+    return replicas.store_epoch == store_epoch.load(std::memory_order_acquire)
+        && replicas.replica_epoch == replica_epoch.load(std::memory_order_acquire)
+        && std::chrono::steady_clock::now() < replicas.expire_at;
+}
+
+ReplicaContextsPtr RegionCache::buildReplicaContexts(Backoffer & bo, const RegionPtr & region)
+{
+    std::vector<metapb::Peer> candidates = region->learners;
+    if (candidates.empty())
+    {
+        uint64_t leader_store_id = region->peer.store_id();
+        for (int i = 0; i < region->meta.peers_size(); i++)
+        {
+            const auto & peer = region->meta.peers(i);
+            if (!peer.is_learner() && peer.store_id() != leader_store_id)
+            {
+                candidates.push_back(peer);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(region->rpc_ctx_mutex);
+    ReplicaContextsPtr cached = std::atomic_load(&region->replica_ctxs);
+    if (cached != nullptr && isFresh(*cached))
+    {
+        return cached;
+    }
+
+    // Read the epochs before the stores, a change in between makes the contexts be built again next time.
+    auto replicas = std::make_shared<ReplicaContexts>();
+    replicas->store_epoch = store_epoch.load(std::memory_order_acquire);
+    replicas->replica_epoch = replica_epoch.load(std::memory_order_acquire);
+    replicas->expire_at = std::chrono::steady_clock::time_point::max();
+    auto now = std::chrono::steady_clock::now();
+    for (const auto & peer : candidates)
+    {
+        {
+            std::lock_guard<std::mutex> down_lock(replica_down_mutex);
+            auto it = replica_down_until.find(peer.store_id());
+            if (it != replica_down_until.end() && it->second > now)
+            {
+                replicas->expire_at = std::min(replicas->expire_at, it->second);
+                continue;
+            }
+        }
+        Store store = getStore(bo, peer.store_id());
+        if (store.addr == "")
+        {
+            continue;
+        }
+        auto liveness = store_prober != nullptr ? store_prober->liveness(store.addr) : nullptr;
+        replicas->replicas.emplace_back(
+            std::make_shared<RPCContext>(region->verID(), region->meta, peer, store.addr, replicas->store_epoch, liveness),
+            store.labels);
+    }
+    std::atomic_store(&region->replica_ctxs, ReplicaContextsPtr(replicas));
+    return replicas;
+}
+
+RPCContextPtr RegionCache::getReplicaRPCContext(
+    Backoffer & bo, const RegionVerID & id, const std::string & label_key, const std::string & label_value)
+{
+    RegionPtr region = getRegionByID(bo, id);
+    ReplicaContextsPtr replicas = std::atomic_load(&region->replica_ctxs);
+    if (replicas == nullptr || !isFresh(*replicas))
+    {
+        replicas = buildReplicaContexts(bo, region);
+    }
+
+    auto is_nearest = [&](const std::map<std::string, std::string> & labels) {
+        auto label = labels.find(label_key);
+        return !label_key.empty() && label != labels.end() && label->second == label_value;
+    };
+    size_t alive = 0, nearest = 0;
+    for (const auto & [ctx, labels] : replicas->replicas)
+    {
+        if (isStoreAlive(*ctx))
+        {
+            alive++;
+            nearest += is_nearest(labels);
+        }
+    }
+    if (alive == 0)
+    {
+        return nullptr;
+    }
+    // Pick among the nearest replicas if any, otherwise among all the live ones.
+    size_t pick = replica_index.fetch_add(1, std::memory_order_relaxed) % (nearest > 0 ? nearest : alive);
+    for (const auto & [ctx, labels] : replicas->replicas)
+    {
+        if (isStoreAlive(*ctx) && (nearest == 0 || is_nearest(labels)) && pick-- == 0)
+        {
+            return ctx;
+        }
+    }
+    // A store died between the passes.
+    return nullptr;
+}
+
+void RegionCache::onReplicaSendReqFail(const RPCContext & ctx)
+{
+    auto now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(replica_down_mutex);
+        for (auto it = replica_down_until.begin(); it != replica_down_until.end();)
+        {
+            if (it->second <= now)
+                it = replica_down_until.erase(it);
+            else
+                ++it;
+        }
+        replica_down_until[ctx.peer.store_id()] = now + replica_down_interval;
+    }
+    replica_epoch.fetch_add(1, std::memory_order_acq_rel);
 }
 
 RegionPtr RegionCache::getRegionByID(Backoffer & bo, const RegionVerID & id)
 {
+    {
+        Rcu::ReadGuard guard(region_rcu);
+        RegionPtr region = region_index.load(std::memory_order_acquire)->getByID(id);
+        if (region != nullptr && !region->invalidated.load(std::memory_order_relaxed) && touch(*region))
+        {
+            hits.add();
+            return region;
+        }
+    }
     std::shared_lock<std::shared_mutex> lock(region_mutex);
     auto it = regions.find(id);
-    if (it == regions.end())
+    if (it == regions.end() || !touch(*it->second))
     {
         lock.unlock();
 
-        auto region = loadRegionByID(bo, id.id);
-
-        insertRegionToCache(region);
-
-        return region;
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return loadRegionByIDShared(bo, id.id);
     }
+    hits.add();
     return it->second;
 }
 
@@ -50,14 +319,97 @@ KeyLocation RegionCache::locateKey(Backoffer & bo, const std::string & key)
     RegionPtr region = searchCachedRegion(key);
     if (region != nullptr)
     {
+        hits.add();
         return KeyLocation(region->verID(), region->startKey(), region->endKey());
     }
 
+    misses.fetch_add(1, std::memory_order_relaxed);
+    region = loadRegionByKeyShared(bo, key);
+
+    return KeyLocation(region->verID(), region->startKey(), region->endKey());
+}
+
+RegionPtr RegionCache::loadRegionByKeyShared(Backoffer & bo, const std::string & key)
+{
+    // Keys of a region that was just dropped share one load, keyed by the start key of the dropped range.
+    std::string flight_key = droppedRangeStart(key);
+    bool shared = false;
+    RegionPtr region;
+    try
+    {
+        region = key_loads.run(
+            flight_key,
+            [&]() {
+                // A load that just finished may have filled the cache.
+                RegionPtr cached = searchCachedRegion(flight_key);
+                if (cached != nullptr)
+                {
+                    return cached;
+                }
+                RegionPtr loaded = loadRegionByKey(bo, flight_key);
+                insertRegionToCache(loaded);
+                return loaded;
+            },
+            &shared);
+    }
+    catch (const Exception &)
+    {
+        // The error belongs to the backoffer of another caller, ours may allow more retries.
+        if (!shared)
+            throw;
+    }
+    if (region != nullptr && region->contains(key))
+    {
+        if (shared)
+            saved_region_loads.fetch_add(1, std::memory_order_relaxed);
+        return region;
+    }
     region = loadRegionByKey(bo, key);
+    insertRegionToCache(region);
+    return region;
+}
 
+RegionPtr RegionCache::loadRegionByIDShared(Backoffer & bo, uint64_t region_id)
+{
+    bool shared = false;
+    try
+    {
+        RegionPtr region = id_loads.run(
+            region_id,
+            [&]() {
+                RegionPtr loaded = loadRegionByID(bo, region_id);
+                insertRegionToCache(loaded);
+                return loaded;
+            },
+            &shared);
+        if (shared)
+            saved_region_loads.fetch_add(1, std::memory_order_relaxed);
+        return region;
+    }
+    catch (const Exception &)
+    {
+        if (!shared)
+            throw;
+    }
+    RegionPtr region = loadRegionByID(bo, region_id);
     insertRegionToCache(region);
+    return region;
+}
 
-    return KeyLocation(region->verID(), region->startKey(), region->endKey());
+std::string RegionCache::droppedRangeStart(const std::string & key)
+{
+    std::shared_lock<std::shared_mutex> lock(region_mutex);
+    auto it = dropped_ranges.upper_bound(key);
+    if (it != dropped_ranges.end() && key >= it->second)
+    {
+        return it->second;
+    }
+    // An empty end key sorts first.
+    if (dropped_ranges.begin() != dropped_ranges.end() && dropped_ranges.begin()->first.empty() && key >= dropped_ranges.begin()->second)
+    {
+        return dropped_ranges.begin()->second;
+    }
+    return key;
 }
 
 // selectLearner select all learner peers.
@@ -82,6 +434,7 @@ std::vector<metapb::Peer> RegionCache::selectLearner(Backoffer & bo, const metap
 
 RegionPtr RegionCache::loadRegionByID(Backoffer & bo, uint64_t region_id)
 {
+    region_loads.fetch_add(1, std::memory_order_relaxed);
     for (;;)
     {
         try
@@ -115,6 +468,7 @@ RegionPtr RegionCache::loadRegionByID(Backoffer & bo, uint64_t region_id)
 
 RegionPtr RegionCache::loadRegionByKey(Backoffer & bo, const std::string & key)
 {
+    region_loads.fetch_add(1, std::memory_order_relaxed);
     for (;;)
     {
         try
@@ -161,48 +515,297 @@ metapb::Store RegionCache::loadStore(Backoffer & bo, uint64_t id)
 
 Store RegionCache::reloadStore(Backoffer & bo, uint64_t id)
 {
-    auto store = loadStore(bo, id);
-    std::map<std::string, std::string> labels;
-    for (size_t i = 0; i < store.labels_size(); i++)
+    Store store(loadStore(bo, id));
+    std::lock_guard<std::mutex> lock(store_mutex);
+    auto * new_stores = new StoreMap(*stores.load());
+    new_stores->insert_or_assign(id, store);
+    publishStoresLocked(new_stores);
+    return store;
+}
+
+std::optional<Store> RegionCache::findStore(uint64_t id)
+{
+    Rcu::ReadGuard guard(store_rcu);
+    const StoreMap * cached = stores.load(std::memory_order_acquire);
+    auto it = cached->find(id);
+    if (it == cached->end())
     {
-        labels[store.labels(i).key()] = store.labels(i).value();
+        return std::nullopt;
     }
-    auto it = stores.emplace(id, Store(id, store.address(), store.peer_address(), labels));
-    return it.first->second;
+    return it->second;
 }
 
 Store RegionCache::getStore(Backoffer & bo, uint64_t id)
 {
-    std::lock_guard<std::mutex> lock(store_mutex);
-    auto it = stores.find(id);
-    if (it != stores.end())
+    if (auto store = findStore(id))
     {
-        return (it->second);
+        return *store;
     }
     return reloadStore(bo, id);
 }
 
+void RegionCache::publishStoresLocked(const StoreMap * new_stores)
+{
+    const StoreMap * old_stores = stores.exchange(new_stores, std::memory_order_acq_rel);
+    store_rcu.synchronize();
+    delete old_stores;
+}
+
+size_t RegionCache::loadAllStores(Backoffer & bo)
+{
+    std::vector<metapb::Store> metas;
+    for (;;)
+    {
+        try
+        {
+            metas = pdClient->getAllStores();
+            break;
+        }
+        catch (Exception & e)
+        {
+            bo.backoff(boPDRPC, e);
+        }
+    }
+
+    auto * new_stores = new StoreMap();
+    for (const auto & meta : metas)
+    {
+        new_stores->emplace(meta.id(), Store(meta));
+    }
+    size_t count = new_stores->size();
+
+    std::lock_guard<std::mutex> lock(store_mutex);
+    bool moved = false;
+    for (const auto & [id, store] : *stores.load())
+    {
+        auto it = new_stores->find(id);
+        moved |= it == new_stores->end() || it->second.addr != store.addr;
+    }
+    publishStoresLocked(new_stores);
+    if (moved)
+    {
+        store_epoch.fetch_add(1, std::memory_order_acq_rel);
+    }
+    return count;
+}
+
+void RegionCache::startStoreRefresher(std::chrono::seconds interval)
+{
+    try
+    {
+        Backoffer bo(loadStoresMaxBackoff);
+        log->information("preloaded " + std::to_string(loadAllStores(bo)) + " stores");
+    }
+    catch (Exception & e)
+    {
+        log->warning("preload stores failed: " + e.displayText());
+    }
+
+    std::lock_guard<std::mutex> lock(store_refresh_mutex);
+    if (store_refresh_thread.joinable())
+    {
+        return;
+    }
+    store_refresh_stop = false;
+    store_refresh_thread = std::thread([this, interval]() {
+        std::unique_lock<std::mutex> lock(store_refresh_mutex);
+        while (!store_refresh_stop)
+        {
+            if (store_refresh_cv.wait_for(lock, interval, [this]() { return store_refresh_stop; }))
+            {
+                break;
+            }
+            lock.unlock();
+            try
+            {
+                Backoffer bo(loadStoresMaxBackoff);
+                loadAllStores(bo);
+            }
+            catch (Exception & e)
+            {
+                log->warning("refresh stores failed: " + e.displayText());
+            }
+            lock.lock();
+        }
+    });
+}
+
+void RegionCache::stopStoreRefresher()
+{
+    {
+        std::lock_guard<std::mutex> lock(store_refresh_mutex);
+        if (!store_refresh_thread.joinable())
+        {
+            return;
+        }
+        store_refresh_stop = true;
+    }
+    store_refresh_cv.notify_all();
+    store_refresh_thread.join();
+}
+
 RegionPtr RegionCache::searchCachedRegion(const std::string & key)
 {
+    RegionPtr region = searchIndexedRegion(key);
+    if (region != nullptr && touch(*region))
+    {
+        return region;
+    }
+    region = nullptr;
+
     std::shared_lock<std::shared_mutex> lock(region_mutex);
     auto it = regions_map.upper_bound(key);
     if (it != regions_map.end() && it->second->contains(key))
     {
-        return it->second;
+        region = it->second;
     }
     // An empty string is considered to be largest string in order.
-    if (regions_map.begin() != regions_map.end() && regions_map.begin()->second->contains(key))
+    else if (regions_map.begin() != regions_map.end() && regions_map.begin()->second->contains(key))
     {
-        return regions_map.begin()->second;
+        region = regions_map.begin()->second;
     }
-    return nullptr;
+    // The index missed a region the cache has, publish it if the last publish is a while ago.
+    if (region != nullptr && pending_changes > 0 && std::chrono::steady_clock::now() - last_publish >= region_index_publish_interval)
+    {
+        lock.unlock();
+        std::unique_lock<std::shared_mutex> write_lock(region_mutex);
+        if (pending_changes > 0)
+        {
+            publishIndex();
+        }
+    }
+    if (region != nullptr && !touch(*region))
+    {
+        return nullptr;
+    }
+    return region;
+}
+
+bool RegionCache::touch(Region & region)
+{
+    int64_t now = regionCacheNow();
+    int64_t last_access = region.last_access.load(std::memory_order_relaxed);
+    if (now - last_access > region_ttl.count())
+    {
+        return false;
+    }
+    // Only write when something changes, hits on a hot region then don't bounce its cache line.
+    if (last_access != now)
+    {
+        region.last_access.store(now, std::memory_order_relaxed);
+    }
+    if (!region.referenced.load(std::memory_order_relaxed))
+    {
+        region.referenced.store(true, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+RegionPtr RegionCache::searchIndexedRegion(const std::string & key)
+{
+    Rcu::ReadGuard guard(region_rcu);
+    RegionPtr region = region_index.load(std::memory_order_acquire)->search(key);
+    if (region != nullptr && region->invalidated.load(std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    return region;
 }
 
 void RegionCache::insertRegionToCache(RegionPtr region)
 {
     std::unique_lock<std::shared_mutex> lock(region_mutex);
-    regions_map[region->endKey()] = region;
-    regions[region->verID()] = region;
+    insertRegionLocked(region);
+    maybePublishIndex();
+}
+
+void RegionCache::insertRegionLocked(const RegionPtr & region)
+{
+    dropped_ranges.erase(region->endKey());
+    auto & by_key = regions_map[region->endKey()];
+    if (by_key != nullptr && by_key != region)
+    {
+        by_key->invalidated = true;
+        // Don't leave the replaced region reachable by id only, it could never be evicted.
+        auto old = regions.find(by_key->verID());
+        if (old != regions.end() && old->second == by_key)
+        {
+            regions.erase(old);
+        }
+    }
+    by_key = region;
+    auto & by_id = regions[region->verID()];
+    if (by_id != nullptr && by_id != region)
+    {
+        by_id->invalidated = true;
+    }
+    by_id = region;
+    pending_changes++;
+    evictLocked(region);
+}
+
+void RegionCache::evictLocked(const RegionPtr & keep)
+{
+    int64_t now = regionCacheNow();
+    size_t steps = 0;
+    // A full round clears all the reference bits, so two rounds are enough to get under max_regions.
+    size_t max_steps = 2 * regions_map.size();
+    while (!regions_map.empty() && steps < max_steps)
+    {
+        bool over_capacity = max_regions > 0 && regions.size() > max_regions;
+        if (!over_capacity && steps >= region_cache_sweep_steps)
+        {
+            break;
+        }
+        steps++;
+
+        auto it = regions_map.lower_bound(clock_hand);
+        if (it == regions_map.end())
+        {
+            it = regions_map.begin();
+        }
+        auto next = std::next(it);
+        clock_hand = next == regions_map.end() ? "" : next->first;
+
+        Region & region = *it->second;
+        if (it->second == keep)
+        {
+            continue;
+        }
+        if (now - region.last_access.load(std::memory_order_relaxed) > region_ttl.count())
+        {
+            eraseRegionLocked(it);
+        }
+        else if (over_capacity && !region.referenced.exchange(false, std::memory_order_relaxed))
+        {
+            eraseRegionLocked(it);
+        }
+    }
+}
+
+void RegionCache::eraseRegionLocked(std::map<std::string, RegionPtr>::iterator it)
+{
+    RegionPtr region = it->second;
+    region->invalidated = true;
+    regions_map.erase(it);
+    auto by_id = regions.find(region->verID());
+    if (by_id != regions.end() && by_id->second == region)
+    {
+        regions.erase(by_id);
+    }
+    pending_changes++;
+    evictions.fetch_add(1, std::memory_order_relaxed);
+}
+
+RegionCacheStats RegionCache::stats()
+{
+    std::shared_lock<std::shared_mutex> lock(region_mutex);
+    return RegionCacheStats{
+        regions.size(),
+        hits.load(),
+        misses.load(std::memory_order_relaxed),
+        evictions.load(std::memory_order_relaxed),
+    };
 }
 
 void RegionCache::dropRegion(const RegionVerID & region_id)
@@ -211,21 +814,52 @@ void RegionCache::dropRegion(const RegionVerID & region_id)
     auto it1 = regions.find(region_id);
     if (it1 != regions.end())
     {
+        RegionPtr region = it1->second;
+        region->invalidated = true;
         regions.erase(it1);
-        auto it = regions_map.find(it1->second->endKey());
-        if (it != regions_map.end())
+        auto it = regions_map.find(region->endKey());
+        if (it != regions_map.end() && it->second == region)
         {
             regions_map.erase(it);
         }
+        if (dropped_ranges.size() >= dropped_ranges_max_size)
+        {
+            dropped_ranges.clear();
+        }
+        dropped_ranges[region->endKey()] = region->startKey();
+        pending_changes++;
+        maybePublishIndex();
         log->information("drop region " + std::to_string(region_id.id) + " because of send failure");
     }
 }
 
+void RegionCache::maybePublishIndex()
+{
+    if (pending_changes >= std::max(region_index_min_batch, regions_map.size() / 16))
+    {
+        publishIndex();
+    }
+}
+
+void RegionCache::publishIndex()
+{
+    const RegionIndex * old_index = region_index.exchange(new RegionIndex(regions_map, regions), std::memory_order_acq_rel);
+    // Writers are serialized by region_mutex, readers of the index never take it.
+    region_rcu.synchronize();
+    delete old_index;
+    pending_changes = 0;
+    last_publish = std::chrono::steady_clock::now();
+}
+
 void RegionCache::dropStore(uint64_t failed_store_id)
 {
     std::lock_guard<std::mutex> lock(store_mutex);
-    if (stores.erase(failed_store_id))
+    if (stores.load()->count(failed_store_id))
     {
+        auto * new_stores = new StoreMap(*stores.load());
+        new_stores->erase(failed_store_id);
+        publishStoresLocked(new_stores);
+        store_epoch.fetch_add(1, std::memory_order_acq_rel);
         log->information("drop store " + std::to_string(failed_store_id) + " because of send failure");
     }
 }
@@ -241,9 +875,24 @@ void RegionCache::onSendReqFail(RPCContextPtr & ctx, const Exception & exc)
 void RegionCache::updateLeader(Backoffer & bo, const RegionVerID & region_id, uint64_t leader_store_id)
 {
     auto region = getRegionByID(bo, region_id);
-    if (!region->switchPeer(leader_store_id))
+    if (region->peer.store_id() == leader_store_id)
+    {
+        return;
+    }
+    // Readers may be using the region and its context, so a new leader means a new region.
+    auto updated = std::make_shared<Region>(region->meta, region->peer, region->learners);
+    if (!updated->switchPeer(leader_store_id))
     {
         dropRegion(region_id);
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(region_mutex);
+    auto it = regions.find(region->verID());
+    // Skip if the region has been dropped or replaced meanwhile.
+    if (it != regions.end() && it->second == region)
+    {
+        insertRegionLocked(updated);
+        maybePublishIndex();
     }
 }
 
@@ -261,23 +910,163 @@ void RegionCache::onRegionStale(Backoffer & bo, RPCContextPtr ctx, const errorpb
     }
 }
 
+size_t RegionCache::loadRegionsInRange(Backoffer & bo, const std::string & start_key, const std::string & end_key, int limit)
+{
+    for (;;)
+    {
+        try
+        {
+            return scanRegions(bo, start_key, end_key, limit);
+        }
+        catch (const Exception & e)
+        {
+            bo.backoff(boPDRPC, e);
+        }
+    }
+}
+
+void RegionCache::prefetchRegions(Backoffer & bo, const std::string & start_key, const std::string & end_key)
+{
+    if (std::chrono::steady_clock::now() < prefetch_paused_until.load() || searchCachedRegion(start_key) != nullptr)
+    {
+        return;
+    }
+    try
+    {
+        scanRegions(bo, start_key, end_key, region_prefetch_limit);
+    }
+    catch (const Exception & e)
+    {
+        // Prefetching is only an optimization, the caller will load the regions one by one.
+        log->warning("prefetch regions failed: " + e.displayText());
+        prefetch_paused_until = std::chrono::steady_clock::now() + region_prefetch_pause;
+    }
+}
+
+size_t RegionCache::scanRegions(Backoffer & bo, const std::string & start_key, const std::string & end_key, int limit)
+{
+    region_loads.fetch_add(1, std::memory_order_relaxed);
+    auto metas = pdClient->scanRegions(start_key, end_key, limit);
+    std::vector<RegionPtr> loaded;
+    loaded.reserve(metas.size());
+    for (auto & [meta, leader] : metas)
+    {
+        if (meta.peers_size() == 0)
+        {
+            continue;
+        }
+        RegionPtr region = std::make_shared<Region>(meta, meta.peers(0), selectLearner(bo, meta));
+        if (leader.IsInitialized())
+        {
+            region->switchPeer(leader.store_id());
+        }
+        loaded.push_back(std::move(region));
+    }
+
+    std::unique_lock<std::shared_mutex> lock(region_mutex);
+    for (auto & region : loaded)
+    {
+        insertRegionLocked(region);
+    }
+    maybePublishIndex();
+    return loaded.size();
+}
+
 std::pair<std::unordered_map<RegionVerID, std::vector<std::string>>, RegionVerID> RegionCache::groupKeysByRegion(
     Backoffer & bo, const std::vector<std::string> & keys)
 {
+    std::vector<std::string_view> sorted(keys.begin(), keys.end());
+    std::sort(sorted.begin(), sorted.end());
     std::unordered_map<RegionVerID, std::vector<std::string>> result_map;
-    KeyLocation loc;
+    for (const auto & group : groupSortedKeys(bo, sorted))
+    {
+        auto & region_keys = result_map[group.region];
+        region_keys.insert(region_keys.end(), sorted.begin() + group.begin, sorted.begin() + group.end);
+    }
     RegionVerID first;
-    for (size_t i = 0; i < keys.size(); i++)
+    if (!keys.empty())
+    {
+        first = locateKey(bo, keys[0]).region;
+    }
+    return std::make_pair(result_map, first);
+}
+
+std::vector<RegionKeys> RegionCache::groupSortedKeys(Backoffer & bo, const std::vector<std::string_view> & keys)
+{
+    size_t threads = std::min<size_t>(std::thread::hardware_concurrency(), keys.size() / group_keys_parallel_min);
+    if (threads <= 1)
+    {
+        return groupSortedKeyRange(bo, keys, 0, keys.size());
+    }
+
+    // Every thread backs off on its own copy of bo.
+    std::vector<std::future<std::vector<RegionKeys>>> parts;
+    size_t chunk = (keys.size() + threads - 1) / threads;
+    for (size_t begin = 0; begin < keys.size(); begin += chunk)
+    {
+        size_t end = std::min(begin + chunk, keys.size());
+        parts.push_back(std::async(std::launch::async, [this, bo, &keys, begin, end]() mutable {
+            return groupSortedKeyRange(bo, keys, begin, end);
+        }));
+    }
+    std::vector<RegionKeys> result;
+    for (auto & part : parts)
     {
-        const std::string & key = keys[i];
-        if (i == 0 || !loc.contains(key))
+        for (const auto & group : part.get())
         {
-            loc = locateKey(bo, key);
-            first = loc.region;
+            // A region may span the boundary of two chunks.
+            if (!result.empty() && result.back().region == group.region && result.back().end == group.begin)
+            {
+                result.back().end = group.end;
+            }
+            else
+            {
+                result.push_back(group);
+            }
         }
-        result_map[loc.region].push_back(key);
     }
-    return std::make_pair(result_map, first);
+    return result;
+}
+
+std::vector<RegionKeys> RegionCache::groupSortedKeyRange(
+    Backoffer & bo, const std::vector<std::string_view> & keys, size_t begin, size_t end)
+{
+    std::vector<RegionKeys> result;
+    size_t i = begin;
+    while (i < end)
+    {
+        std::string_view key = keys[i];
+        RegionVerID region_id;
+        std::string region_end;
+        RegionPtr region;
+        {
+            Rcu::ReadGuard guard(region_rcu);
+            region = region_index.load(std::memory_order_acquire)->search(key);
+        }
+        if (region != nullptr && !region->invalidated.load(std::memory_order_relaxed) && touch(*region))
+        {
+            hits.add();
+            region_id = region->verID();
+            region_end = region->endKey();
+        }
+        else
+        {
+            std::string key_str(key);
+            prefetchRegions(bo, key_str, std::string(keys[end - 1]) + '\0');
+            auto loc = locateKey(bo, key_str);
+            region_id = loc.region;
+            region_end = loc.end_key;
+        }
+
+        size_t next = end;
+        if (!region_end.empty())
+        {
+            next = std::lower_bound(keys.begin() + i, keys.begin() + end, std::string_view(region_end)) - keys.begin();
+        }
+        result.emplace_back(region_id, i, next);
+        i = next;
+    }
+    return result;
 }
 
 } // namespace kv
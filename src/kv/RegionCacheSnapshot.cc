@@ -0,0 +1,334 @@
+#include <pingcap/kv/Region.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace pingcap
+{
+namespace kv
+{
+
+// The snapshot is a header followed by the store records and the region records. A store record is a length prefixed
+// metapb::Store, a region record is the store id of the leader followed by a length prefixed metapb::Region. Integers
+// are in native byte order, so the file can be read in place from a mapping.
+namespace
+{
+
+constexpr char snapshot_magic[8] = {'R', 'E', 'G', 'I', 'O', 'N', 'S', '\0'};
+
+constexpr uint32_t snapshot_version = 1;
+
+constexpr uint32_t snapshot_byte_order = 0x01020304;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t store_count;
+    uint64_t region_count;
+};
+
+template <class T>
+void appendPod(std::string & buf, const T & value)
+{
+    buf.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void appendMessage(std::string & buf, const google::protobuf::Message & message)
+{
+    appendPod(buf, static_cast<uint32_t>(message.ByteSizeLong()));
+    message.AppendToString(&buf);
+}
+
+// writeFileSynced writes buf to path and flushes it to disk. Returns the errno of the failure, or 0.
+int writeFileSynced(const std::string & path, const std::string & buf)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return errno;
+    size_t written = 0;
+    while (written < buf.size())
+    {
+        ssize_t n = ::write(fd, buf.data() + written, buf.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            int err = errno;
+            ::close(fd);
+            return err;
+        }
+        written += n;
+    }
+    int err = ::fsync(fd) != 0 ? errno : 0;
+    if (::close(fd) != 0 && err == 0)
+        err = errno;
+    return err;
+}
+
+// syncParentDir flushes the directory entry of path, so a rename into it survives a power loss.
+int syncParentDir(const std::string & path)
+{
+    auto slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return errno;
+    int err = ::fsync(fd) != 0 ? errno : 0;
+    ::close(fd);
+    return err;
+}
+
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char * data_, size_t size_) : data(data_), size(size_), pos(0) {}
+
+    template <class T>
+    bool readPod(T & value)
+    {
+        if (size - pos < sizeof(T))
+            return false;
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool readMessage(google::protobuf::Message & message)
+    {
+        uint32_t length;
+        if (!readPod(length) || size - pos < length)
+            return false;
+        bool ok = message.ParseFromArray(data + pos, length);
+        pos += length;
+        return ok;
+    }
+
+private:
+    const char * data;
+    size_t size;
+    size_t pos;
+};
+
+} // namespace
+
+bool RegionCache::saveSnapshot(const std::string & path)
+{
+    std::vector<RegionPtr> cached_regions;
+    {
+        std::shared_lock<std::shared_mutex> lock(region_mutex);
+        cached_regions.reserve(regions_map.size());
+        for (const auto & [end_key, region] : regions_map)
+        {
+            cached_regions.push_back(region);
+        }
+    }
+    std::vector<Store> cached_stores;
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        for (const auto & [id, store] : *stores.load())
+        {
+            cached_stores.push_back(store);
+        }
+    }
+
+    SnapshotHeader header;
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.byte_order = snapshot_byte_order;
+    header.store_count = cached_stores.size();
+    header.region_count = cached_regions.size();
+
+    std::string buf;
+    appendPod(buf, header);
+    for (const auto & store : cached_stores)
+    {
+        metapb::Store meta;
+        meta.set_id(store.id);
+        meta.set_address(store.addr);
+        meta.set_peer_address(store.peer_addr);
+        for (const auto & [key, value] : store.labels)
+        {
+            auto * label = meta.add_labels();
+            label->set_key(key);
+            label->set_value(value);
+        }
+        appendMessage(buf, meta);
+    }
+    for (const auto & region : cached_regions)
+    {
+        appendPod(buf, static_cast<uint64_t>(region->peer.store_id()));
+        appendMessage(buf, region->meta);
+    }
+
+    // Write aside, sync and rename, then sync the directory, so neither a crash nor a power loss leaves a torn snapshot
+    // behind.
+    std::string tmp_path = path + ".tmp";
+    if (int err = writeFileSynced(tmp_path, buf); err != 0)
+    {
+        log->warning("write region cache snapshot to " + tmp_path + " failed: " + std::strerror(err));
+        return false;
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        log->warning("rename region cache snapshot to " + path + " failed: " + std::strerror(errno));
+        return false;
+    }
+    if (int err = syncParentDir(path); err != 0)
+    {
+        log->warning("sync the directory of region cache snapshot " + path + " failed: " + std::strerror(err));
+        return false;
+    }
+    log->debug("saved " + std::to_string(cached_regions.size()) + " regions to " + path);
+    return true;
+}
+
+size_t RegionCache::loadSnapshot(const std::string & path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(SnapshotHeader)))
+    {
+        ::close(fd);
+        return 0;
+    }
+    size_t size = st.st_size;
+    void * data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        log->warning("map region cache snapshot " + path + " failed: " + std::strerror(errno));
+        return 0;
+    }
+
+    SnapshotReader reader(static_cast<const char *>(data), size);
+    SnapshotHeader header;
+    std::vector<metapb::Store> store_metas;
+    std::vector<std::pair<metapb::Region, uint64_t>> region_metas;
+    bool ok = reader.readPod(header) && std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) == 0
+        && header.version == snapshot_version && header.byte_order == snapshot_byte_order;
+    for (uint64_t i = 0; ok && i < header.store_count; i++)
+    {
+        store_metas.emplace_back();
+        ok = reader.readMessage(store_metas.back());
+    }
+    for (uint64_t i = 0; ok && i < header.region_count; i++)
+    {
+        region_metas.emplace_back();
+        ok = reader.readPod(region_metas.back().second) && reader.readMessage(region_metas.back().first);
+    }
+    ::munmap(data, size);
+    if (!ok)
+    {
+        log->warning("region cache snapshot " + path + " is corrupted, ignore it");
+        return 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        auto * new_stores = new StoreMap(*stores.load());
+        for (const auto & meta : store_metas)
+        {
+            new_stores->emplace(meta.id(), Store(meta));
+        }
+        publishStoresLocked(new_stores);
+    }
+
+    // The seeded regions are possibly stale. They are backdated so that the ones not used soon expire, and the used
+    // ones are fixed by the usual EpochNotMatch and NotLeader handling.
+    int64_t last_access = regionCacheNow() - std::max<int64_t>(region_ttl.count() - seeded_region_ttl.count(), 0);
+    Backoffer bo(loadSnapshotMaxBackoff);
+    std::vector<RegionPtr> seeded;
+    seeded.reserve(region_metas.size());
+    for (const auto & [meta, leader_store_id] : region_metas)
+    {
+        if (meta.peers_size() == 0)
+        {
+            continue;
+        }
+        std::vector<metapb::Peer> learners;
+        try
+        {
+            learners = selectLearner(bo, meta);
+        }
+        catch (const Exception & e)
+        {
+            log->warning("select learners of seeded region " + std::to_string(meta.id()) + " failed: " + e.displayText());
+            continue;
+        }
+        RegionPtr region = std::make_shared<Region>(meta, meta.peers(0), learners);
+        region->switchPeer(leader_store_id);
+        region->last_access = last_access;
+        region->referenced = false;
+        seeded.push_back(std::move(region));
+    }
+
+    std::unique_lock<std::shared_mutex> lock(region_mutex);
+    size_t count = 0;
+    for (const auto & region : seeded)
+    {
+        // Anything loaded meanwhile is fresher.
+        if (regions_map.count(region->endKey()) == 0)
+        {
+            insertRegionLocked(region);
+            count++;
+        }
+    }
+    maybePublishIndex();
+    log->information("seeded " + std::to_string(count) + " regions from " + path);
+    return count;
+}
+
+void RegionCache::startPersistence(const std::string & path, std::chrono::seconds interval)
+{
+    loadSnapshot(path);
+    std::lock_guard<std::mutex> lock(persist_mutex);
+    if (persist_thread.joinable())
+    {
+        return;
+    }
+    persist_path = path;
+    persist_stop = false;
+    persist_thread = std::thread([this, interval]() {
+        std::unique_lock<std::mutex> lock(persist_mutex);
+        while (!persist_stop)
+        {
+            if (persist_cv.wait_for(lock, interval, [this]() { return persist_stop; }))
+            {
+                break;
+            }
+            lock.unlock();
+            saveSnapshot(persist_path);
+            lock.lock();
+        }
+    });
+}
+
+void RegionCache::stopPersistence()
+{
+    {
+        std::lock_guard<std::mutex> lock(persist_mutex);
+        if (!persist_thread.joinable())
+        {
+            return;
+        }
+        persist_stop = true;
+    }
+    persist_cv.notify_all();
+    persist_thread.join();
+    saveSnapshot(persist_path);
+}
+
+} // namespace kv
+} // namespace pingcap
@@ -55,8 +55,41 @@ void RegionClient::onRegionError(Backoffer & bo, RPCContextPtr rpc_ctx, const er
     cache->dropRegion(rpc_ctx->region);
 }
 
+bool RegionClient::isCanceledOrTimeout(std::exception_ptr err)
+{
+    try
+    {
+        std::rethrow_exception(err);
+    }
+    catch (const Exception & e)
+    {
+        return e.code() == DeadlineExceeded || e.code() == RequestCanceled;
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+RPCContextPtr RegionClient::getReplicaRPCContext(Backoffer & bo, const ReplicaRead & replica)
+{
+    try
+    {
+        return cache->getReplicaRPCContext(bo, region_id, replica.label_key, replica.label_value);
+    }
+    catch (const Exception & e)
+    {
+        log->warning("locate replica of region " + std::to_string(region_id.id) + " failed: " + e.displayText());
+        return nullptr;
+    }
+}
+
 void RegionClient::onSendFail(Backoffer & bo, const Exception & e, RPCContextPtr rpc_ctx)
 {
+    if (e.code() == DeadlineExceeded || e.code() == RequestCanceled)
+    {
+        e.rethrow();
+    }
     cache->onSendReqFail(rpc_ctx, e);
     // Retry on send request failure when it's not canceled.
     // When a store is not available, the leader of related region should be elected quickly.
@@ -5,37 +5,122 @@ namespace pingcap
 namespace kv
 {
 
-ConnArray::ConnArray(size_t max_size, std::string addr) : index(0)
+ConnArray::ConnArray(size_t max_size, std::string addr, bool enable_batch) : index(0)
 {
     vec.resize(max_size);
     for (size_t i = 0; i < max_size; i++)
     {
         vec[i] = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+        stubs.push_back(tikvpb::Tikv::NewStub(vec[i]));
+        if (enable_batch)
+        {
+            batch_clients.push_back(std::make_shared<BatchCommandsClient>(vec[i]));
+        }
     }
 }
 
-std::shared_ptr<grpc::Channel> ConnArray::get()
+std::shared_ptr<grpc::Channel> ConnArray::get() { return vec[nextIndex()]; }
+
+std::shared_ptr<tikvpb::Tikv::Stub> ConnArray::getStub() { return stubs[nextIndex()]; }
+
+BatchCommandsClientPtr ConnArray::getBatchClient() { return batch_clients[nextIndex()]; }
+
+AsyncPoller::AsyncPoller(size_t size) : index(0), log(&Logger::get("pingcap.tikv"))
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    index = (index + 1) % vec.size();
-    return vec[index];
+    for (size_t i = 0; i < size; i++)
+    {
+        queues.push_back(std::make_shared<grpc::CompletionQueue>());
+    }
+    for (auto & queue : queues)
+    {
+        threads.emplace_back([cq = queue, log = log]() { run(cq, log); });
+    }
+}
+
+AsyncPoller::~AsyncPoller()
+{
+    for (auto & queue : queues)
+    {
+        queue->Shutdown();
+    }
+    for (auto & thread : threads)
+    {
+        // The last reference to the rpc client may be dropped by a callback on a poller thread, which can't join itself.
+        // It drains its queue and exits on its own.
+        if (thread.get_id() == std::this_thread::get_id())
+            thread.detach();
+        else
+            thread.join();
+    }
+}
+
+grpc::CompletionQueue * AsyncPoller::getQueue() { return queues[index.fetch_add(1, std::memory_order_relaxed) % queues.size()].get(); }
+
+void AsyncPoller::run(std::shared_ptr<grpc::CompletionQueue> cq, Logger * log)
+{
+    void * tag;
+    bool ok;
+    while (cq->Next(&tag, &ok))
+    {
+        try
+        {
+            static_cast<AsyncCallTag *>(tag)->proceed(ok);
+        }
+        catch (const std::exception & e)
+        {
+            log->error(std::string("async rpc callback throws: ") + e.what());
+        }
+    }
+}
+
+AsyncPoller & RpcClient::asyncPoller()
+{
+    std::call_once(poller_flag, [this]() { poller = std::make_unique<AsyncPoller>(async_poller_size); });
+    return *poller;
+}
+
+std::vector<StoreTimeout> RpcClient::getStoreTimeouts()
+{
+    std::vector<StoreTimeout> result;
+    const ConnMap * current = conns.load(std::memory_order_acquire);
+    for (const auto & it : *current)
+    {
+        const auto & latency = it.second->latency;
+        for (int type = 0; type < rpcTypeCount; type++)
+        {
+            auto tp = RpcType(type);
+            auto timeout = adaptive_timeout ? latency.timeout(tp, rpc_timeout) : std::chrono::milliseconds(rpc_timeout);
+            result.push_back(StoreTimeout{it.first, tp, latency.p99(tp), timeout});
+        }
+    }
+    return result;
 }
 
 ConnArrayPtr RpcClient::getConnArray(const std::string & addr)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    auto it = conns.find(addr);
-    if (it == conns.end())
+    const ConnMap * current = conns.load(std::memory_order_acquire);
+    auto it = current->find(addr);
+    if (it != current->end())
     {
-        return createConnArray(addr);
+        return it->second;
     }
-    return it->second;
+    return createConnArray(addr);
 }
 
 ConnArrayPtr RpcClient::createConnArray(const std::string & addr)
 {
-    auto conn_array = std::make_shared<ConnArray>(5, addr);
-    conns[addr] = conn_array;
+    std::lock_guard<std::mutex> lock(mutex);
+    const ConnMap * current = conns.load(std::memory_order_relaxed);
+    auto it = current->find(addr);
+    if (it != current->end())
+    {
+        return it->second;
+    }
+    auto conn_array = std::make_shared<ConnArray>(5, addr, enable_batch);
+    auto next = std::make_unique<ConnMap>(*current);
+    next->emplace(addr, conn_array);
+    conns.store(next.get(), std::memory_order_release);
+    conn_maps.push_back(std::move(next));
     return conn_array;
 }
 
@@ -21,7 +21,7 @@ inline std::string prefixNext(const std::string & str)
 
 void Scanner::next()
 {
-    Backoffer bo(scanMaxBackoff);
+    Backoffer bo(scanMaxBackoff, deadline);
     if (!valid)
     {
         throw Exception("the scanner is invalid", LogicalError);
@@ -30,7 +30,7 @@ void Scanner::next()
     for (;;)
     {
         idx++;
-        if (idx >= cache.size())
+        if (idx >= cacheSize())
         {
             if (eof)
             {
@@ -38,13 +38,13 @@ void Scanner::next()
                 return;
             }
             getData(bo);
-            if (idx >= cache.size())
+            if (idx >= cacheSize())
             {
                 continue;
             }
         }
 
-        auto current = cache[idx];
+        const auto & current = cache->getResp()->pairs(idx);
         if (end_key.size() > 0 && current.key() >= end_key)
         {
             eof = true;
@@ -60,13 +60,15 @@ void Scanner::getData(Backoffer & bo)
     log->debug("get data for scanner");
     for (;;)
     {
+        snap.cache->prefetchRegions(bo, next_start_key, end_key);
         auto loc = snap.cache->locateKey(bo, next_start_key);
         auto req_end_key = end_key;
         if (req_end_key.size() > 0 && loc.end_key.size() > 0 && loc.end_key < req_end_key)
             req_end_key = loc.end_key;
 
         auto regionClient = RegionClient(snap.cache, snap.client, loc.region);
-        auto request = new kvrpcpb::ScanRequest();
+        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::ScanRequest>>();
+        auto request = rpc_call->getReq();
         request->set_start_key(next_start_key);
         request->set_end_key(req_end_key);
         request->set_limit(batch);
@@ -77,10 +79,12 @@ void Scanner::getData(Backoffer & bo)
         context->set_priority(::kvrpcpb::Normal);
         context->set_not_fill_cache(false);
 
-        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::ScanRequest>>(request);
         try
         {
-            regionClient.sendReqToRegion(bo, rpc_call);
+            if (snap.replica_read.enabled)
+                regionClient.sendReqToReplica(bo, rpc_call, snap.replica_read);
+            else
+                regionClient.sendReqToRegion(bo, rpc_call);
         }
         catch (Exception & e)
         {
@@ -93,18 +97,26 @@ void Scanner::getData(Backoffer & bo)
 
         auto responce = rpc_call->getResp();
         int pairs_size = responce->pairs_size();
-        idx = 0;
-        cache.clear();
+        std::vector<Lock> locks;
         for (int i = 0; i < pairs_size; i++)
         {
-            auto current = responce->pairs(i);
-            if (current.has_error())
+            const auto & pair = responce->pairs(i);
+            if (pair.has_error())
             {
-                // process lock
-                throw Exception("has key error", LockError);
+                if (snap.lock_resolver == nullptr || !pair.error().has_locked())
+                    throw Exception("has key error", LockError);
+                locks.emplace_back(pair.error().locked());
             }
-            cache.push_back(current);
         }
+        if (!locks.empty())
+        {
+            if (snap.lock_resolver->resolveLocks(bo, snap.version, locks) > 0)
+                bo.backoff(boTxnLockFast, Exception("keys are locked", LockError));
+            continue;
+        }
+        idx = 0;
+        // The pairs are read in place from the response, instead of being copied out of its arena.
+        cache = rpc_call;
 
         log->debug("get pair size: " + std::to_string(pairs_size));
 
@@ -10,27 +10,75 @@ namespace kv
 
 constexpr int scan_batch_size = 256;
 
+// Groups of a BatchGet larger than this are split into several requests.
+constexpr size_t batch_get_max_keys = 5120;
+
 //bool extractLockFromKeyErr()
 
-std::string Snapshot::Get(const std::string & key)
+SnapshotCache * Snapshot::readCache() const
+{
+    if (read_cache != nullptr && read_cache->version != version)
+        throw Exception("read cache of version " + std::to_string(read_cache->version) + " used by snapshot of version "
+                + std::to_string(version),
+            LogicalError);
+    return read_cache.get();
+}
+
+std::string Snapshot::Get(const std::string & key, Deadline deadline)
+{
+    SnapshotCache * snapshot_cache = readCache();
+    std::string value;
+    if (snapshot_cache != nullptr && snapshot_cache->get(key, value))
+        return value;
+    value = getShared(key, deadline);
+    if (snapshot_cache != nullptr)
+        snapshot_cache->put(key, value);
+    return value;
+}
+
+std::string Snapshot::getShared(const std::string & key, Deadline deadline)
+{
+    if (get_flights == nullptr)
+        return getFromTiKV(key, deadline);
+
+    bool shared = false;
+    try
+    {
+        return get_flights->run(std::make_pair(key, version), [&]() { return getFromTiKV(key, deadline); }, &shared);
+    }
+    catch (Exception & e)
+    {
+        // The deadline of the caller that ran the read may be earlier than ours.
+        if (shared && (e.code() == DeadlineExceeded || e.code() == RequestCanceled))
+            return getFromTiKV(key, deadline);
+        throw;
+    }
+}
+
+std::string Snapshot::getFromTiKV(const std::string & key, Deadline deadline)
 {
-    Backoffer bo(GetMaxBackoff);
+    Backoffer bo(GetMaxBackoff, deadline);
     for (;;)
     {
         auto location = cache->locateKey(bo, key);
         auto regionClient = RegionClient(cache, client, location.region);
-        auto request = new kvrpcpb::GetRequest();
+        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::GetRequest>>();
+        auto request = rpc_call->getReq();
         request->set_key(key);
         request->set_version(version);
 
         auto context = request->mutable_context();
         context->set_priority(::kvrpcpb::Normal);
         context->set_not_fill_cache(false);
-        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::GetRequest>>(request);
 
         try
         {
-            regionClient.sendReqToRegion(bo, rpc_call);
+            if (replica_read.enabled)
+                regionClient.sendReqToReplica(bo, rpc_call, replica_read);
+            else if (hedge_delay.count() > 0)
+                rpc_call = hedgedSend(bo, location.region, rpc_call);
+            else
+                regionClient.sendReqToRegion(bo, rpc_call);
         }
         catch (Exception & e)
         {
@@ -41,13 +89,240 @@ std::string Snapshot::Get(const std::string & key)
         auto response = rpc_call->getResp();
         if (response->has_error())
         {
-            throw Exception("has key error", LockError);
+            if (lock_resolver == nullptr || !response->error().has_locked())
+                throw Exception("has key error", LockError);
+            if (lock_resolver->resolveLocks(bo, version, {Lock(response->error().locked())}) > 0)
+                bo.backoff(boTxnLockFast, Exception("key is locked", LockError));
+            continue;
         }
         return response->value();
     }
 }
 
-Scanner Snapshot::Scan(const std::string & begin, const std::string & end) { return Scanner(*this, begin, end, scan_batch_size); }
+RpcCallPtr<kvrpcpb::GetRequest> Snapshot::hedgedSend(Backoffer & bo, const RegionVerID & region, RpcCallPtr<kvrpcpb::GetRequest> rpc_call)
+{
+    struct Race
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        RpcCallPtr<kvrpcpb::GetRequest> winner;
+        std::exception_ptr leader_err;
+        bool leader_done = false;
+        bool replica_done = false;
+    };
+    auto race = std::make_shared<Race>();
+
+    RegionClient(cache, client, region).sendReqToRegionAsync(bo, rpc_call, [race, rpc_call](std::exception_ptr err) {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        race->leader_done = true;
+        if (err)
+            race->leader_err = err;
+        else if (race->winner == nullptr)
+            race->winner = rpc_call;
+        race->cv.notify_all();
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(race->mutex);
+        if (race->cv.wait_for(lock, hedge_delay, [&]() { return race->leader_done; }))
+        {
+            if (race->winner == nullptr)
+                std::rethrow_exception(race->leader_err);
+            return race->winner;
+        }
+    }
+
+    RPCContextPtr ctx;
+    try
+    {
+        ctx = cache->getReplicaRPCContext(bo, region);
+    }
+    catch (const Exception & e)
+    {
+        log->warning("no replica to hedge get: " + e.displayText());
+    }
+
+    RpcCallPtr<kvrpcpb::GetRequest> replica_call;
+    if (ctx != nullptr)
+    {
+        replica_call = std::make_shared<RpcCall<kvrpcpb::GetRequest>>();
+        replica_call->getReq()->CopyFrom(*rpc_call->getReq());
+        replica_call->setCtx(ctx);
+        replica_call->getReq()->mutable_context()->set_replica_read(true);
+        replica_call->setDeadline(bo.deadline);
+        try
+        {
+            client->sendRequestAsync(ctx->addr, replica_call, [race, replica_call](std::exception_ptr err) {
+                std::lock_guard<std::mutex> lock(race->mutex);
+                race->replica_done = true;
+                // A region error from the replica is left to the leader request to handle.
+                if (!err && !replica_call->getResp()->has_region_error() && race->winner == nullptr)
+                    race->winner = replica_call;
+                race->cv.notify_all();
+            });
+        }
+        catch (const Exception & e)
+        {
+            log->warning("send hedged get failed: " + e.displayText());
+            replica_call = nullptr;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(race->mutex);
+    race->cv.wait(lock, [&]() { return race->winner != nullptr || (race->leader_done && (replica_call == nullptr || race->replica_done)); });
+    if (race->winner == nullptr)
+        std::rethrow_exception(race->leader_err);
+    if (race->winner == rpc_call)
+    {
+        if (replica_call != nullptr)
+            replica_call->cancel();
+    }
+    else
+    {
+        rpc_call->cancel();
+    }
+    return race->winner;
+}
+
+std::unordered_map<std::string, std::string> Snapshot::BatchGet(const std::vector<std::string> & keys, Deadline deadline)
+{
+    SnapshotCache * snapshot_cache = readCache();
+    std::unordered_map<std::string, std::string> result;
+    std::vector<std::string_view> sorted_keys;
+    sorted_keys.reserve(keys.size());
+    std::string value;
+    for (const auto & key : keys)
+    {
+        if (snapshot_cache == nullptr || !snapshot_cache->get(key, value))
+            sorted_keys.push_back(key);
+        else if (!value.empty())
+            result.emplace(key, value);
+    }
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+    sorted_keys.erase(std::unique(sorted_keys.begin(), sorted_keys.end()), sorted_keys.end());
+
+    Backoffer bo(GetMaxBackoff, deadline);
+    batchGetKeys(bo, sorted_keys, result);
+    if (snapshot_cache != nullptr)
+    {
+        for (const auto & key : sorted_keys)
+        {
+            auto it = result.find(std::string(key));
+            snapshot_cache->put(std::string(key), it == result.end() ? std::string() : it->second);
+        }
+    }
+    return result;
+}
+
+std::vector<std::string> Snapshot::BatchGetValues(const std::vector<std::string> & keys, Deadline deadline)
+{
+    auto result = BatchGet(keys, deadline);
+    std::vector<std::string> values;
+    values.reserve(keys.size());
+    for (const auto & key : keys)
+    {
+        auto it = result.find(key);
+        values.push_back(it == result.end() ? std::string() : it->second);
+    }
+    return values;
+}
+
+void Snapshot::batchGetKeys(Backoffer & bo, const std::vector<std::string_view> & keys, std::unordered_map<std::string, std::string> & result)
+{
+    std::vector<RegionKeys> batches;
+    for (const auto & group : cache->groupSortedKeys(bo, keys))
+    {
+        for (size_t begin = group.begin; begin < group.end; begin += batch_get_max_keys)
+        {
+            batches.push_back(RegionKeys{group.region, begin, std::min(group.end, begin + batch_get_max_keys)});
+        }
+    }
+
+    std::vector<RpcCallPtr<kvrpcpb::BatchGetRequest>> rpc_calls;
+    std::vector<std::future<void>> responses;
+    rpc_calls.reserve(batches.size());
+    responses.reserve(batches.size());
+    for (const auto & batch : batches)
+    {
+        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::BatchGetRequest>>();
+        auto * request = rpc_call->getReq();
+        for (size_t i = batch.begin; i < batch.end; i++)
+        {
+            request->add_keys(keys[i].data(), keys[i].size());
+        }
+        request->set_version(version);
+        request->mutable_context()->set_priority(::kvrpcpb::Normal);
+        rpc_calls.push_back(rpc_call);
+        RegionClient region_client(cache, client, batch.region);
+        if (replica_read.enabled)
+            responses.push_back(region_client.sendReqToReplicaAsync(bo, rpc_call, replica_read));
+        else
+            responses.push_back(region_client.sendReqToRegionAsync(bo, rpc_call));
+    }
+
+    std::vector<std::string_view> failed_keys;
+    std::exception_ptr failure;
+    std::vector<Lock> locks;
+    for (size_t i = 0; i < batches.size(); i++)
+    {
+        try
+        {
+            responses[i].get();
+        }
+        catch (Exception & e)
+        {
+            // The region has likely split or merged, its keys are grouped again.
+            cache->dropRegion(batches[i].region);
+            failed_keys.insert(failed_keys.end(), keys.begin() + batches[i].begin, keys.begin() + batches[i].end);
+            failure = std::current_exception();
+            continue;
+        }
+        size_t locked_begin = failed_keys.size();
+        for (const auto & pair : rpc_calls[i]->getResp()->pairs())
+        {
+            if (pair.has_error())
+            {
+                if (lock_resolver == nullptr || !pair.error().has_locked())
+                    throw Exception("has key error", LockError);
+                locks.emplace_back(pair.error().locked());
+                failed_keys.push_back(pair.key());
+                continue;
+            }
+            result.emplace(pair.key(), pair.value());
+        }
+        // failed_keys views the keys of the caller, not the ones of the response.
+        for (size_t j = locked_begin; j < failed_keys.size(); j++)
+        {
+            failed_keys[j] = *std::lower_bound(keys.begin() + batches[i].begin, keys.begin() + batches[i].end, failed_keys[j]);
+        }
+    }
+
+    if (!locks.empty() && lock_resolver->resolveLocks(bo, version, locks) > 0)
+    {
+        bo.backoff(boTxnLockFast, Exception("keys are locked", LockError));
+    }
+    if (failure)
+    {
+        try
+        {
+            std::rethrow_exception(failure);
+        }
+        catch (Exception & e)
+        {
+            bo.backoff(boRegionMiss, e);
+        }
+    }
+    if (!failed_keys.empty())
+    {
+        std::sort(failed_keys.begin(), failed_keys.end());
+        batchGetKeys(bo, failed_keys, result);
+    }
+}
+
+Scanner Snapshot::Scan(const std::string & begin, const std::string & end, Deadline deadline)
+{
+    return Scanner(*this, begin, end, scan_batch_size, deadline);
+}
 
 } // namespace kv
 } // namespace pingcap
@@ -0,0 +1,83 @@
+#include <pingcap/kv/StoreProber.h>
+
+#include <grpcpp/channel.h>
+
+#include <vector>
+
+namespace pingcap
+{
+namespace kv
+{
+
+StoreProber::StoreProber(RpcClientPtr client_, std::chrono::milliseconds interval_)
+    : client(client_), interval(interval_), stopped(false), log(&Logger::get("pingcap.tikv"))
+{
+    thread = std::thread([this]() { run(); });
+}
+
+StoreProber::~StoreProber()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+StoreLivenessPtr StoreProber::liveness(const std::string & addr)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto & liveness = stores[addr];
+    if (liveness == nullptr)
+    {
+        liveness = std::make_shared<StoreLiveness>();
+    }
+    return liveness;
+}
+
+void StoreProber::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!cv.wait_for(lock, interval, [this]() { return stopped; }))
+    {
+        std::vector<std::pair<std::string, StoreLivenessPtr>> targets(stores.begin(), stores.end());
+        lock.unlock();
+        for (auto & [addr, liveness] : targets)
+        {
+            probe(addr, *liveness);
+        }
+        lock.lock();
+    }
+}
+
+void StoreProber::probe(const std::string & addr, StoreLiveness & liveness)
+{
+    // All the channels of a store connect to the same address, one tells enough.
+    auto channel = client->getConnArray(addr)->get();
+    // Asking for the state makes an idle channel connect. Waiting for a change drives the connection attempt, a failed
+    // one shows up as TRANSIENT_FAILURE and a hanging one stays CONNECTING.
+    auto state = channel->GetState(true);
+    auto deadline = std::chrono::system_clock::now() + store_probe_timeout;
+    while ((state == GRPC_CHANNEL_IDLE || state == GRPC_CHANNEL_CONNECTING) && channel->WaitForStateChange(state, deadline))
+    {
+        state = channel->GetState(true);
+    }
+    bool connectable = state == GRPC_CHANNEL_READY;
+
+    if (connectable)
+    {
+        liveness.failures = 0;
+        if (!liveness.alive.exchange(true, std::memory_order_relaxed))
+        {
+            log->information("store " + addr + " is reachable again");
+        }
+    }
+    else if (++liveness.failures >= store_probe_max_failures && liveness.alive.exchange(false, std::memory_order_relaxed))
+    {
+        log->warning("store " + addr + " is unreachable");
+    }
+}
+
+} // namespace kv
+} // namespace pingcap
@@ -30,7 +30,7 @@ inline std::vector<std::string> addrsToUrls(const std::vector<std::string> & add
 Client::Client(const std::vector<std::string> & addrs)
     : max_init_cluster_retries(100),
       pd_timeout(3),
-      loop_interval(100),
+      update_leader_retry_interval(100),
       update_leader_interval(60),
       urls(addrsToUrls(addrs)),
       log(&Logger::get("pingcap.pd"))
@@ -39,14 +39,30 @@ Client::Client(const std::vector<std::string> & addrs)
 
     updateLeader();
 
-    work_threads_stop = false;
-
     work_thread = std::thread([&]() { leaderLoop(); });
+
+    tso_thread = std::thread([&]() { tsoLoop(); });
 }
 
 Client::~Client()
 {
-    work_threads_stop = true;
+    {
+        std::lock_guard<std::mutex> lk(tso_mutex);
+        tso_stop = true;
+        if (tso_context != nullptr)
+            tso_context->TryCancel();
+    }
+    tso_cv.notify_one();
+    if (tso_thread.joinable())
+    {
+        tso_thread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(update_leader_mutex);
+        work_threads_stop = true;
+    }
+    update_leader_cv.notify_one();
 
     if (work_thread.joinable())
     {
@@ -92,12 +108,7 @@ pdpb::GetMembersResponse Client::getMembers(std::string url)
     return resp;
 }
 
-std::unique_ptr<pdpb::PD::Stub> Client::leaderStub()
-{
-    std::shared_lock lk(leader_mutex);
-    auto cc = getOrCreateGRPCConn(leader);
-    return pdpb::PD::NewStub(cc);
-}
+std::shared_ptr<pdpb::PD::Stub> Client::leaderStub() { return std::atomic_load(&leader_stub); }
 
 void Client::initClusterID()
 {
@@ -146,7 +157,9 @@ void Client::switchLeader(const ::google::protobuf::RepeatedPtrField<std::string
         return;
     }
 
-    getOrCreateGRPCConn(leader);
+    std::shared_ptr<pdpb::PD::Stub> stub = pdpb::PD::NewStub(getOrCreateGRPCConn(leader));
+    std::atomic_store(&leader_stub, stub);
+    tso_stream_stale.store(true);
 }
 
 void Client::updateURLs(const ::google::protobuf::RepeatedPtrField<::pdpb::Member> & members)
@@ -165,42 +178,51 @@ void Client::updateURLs(const ::google::protobuf::RepeatedPtrField<::pdpb::Membe
 
 void Client::leaderLoop()
 {
-    auto next_update_time = std::chrono::system_clock::now();
+    auto next_update_time = std::chrono::steady_clock::now() + update_leader_interval;
 
     for (;;)
     {
-        bool should_update = false;
-        std::unique_lock<std::mutex> lk(update_leader_mutex);
-        auto now = std::chrono::system_clock::now();
-        if (update_leader_cv.wait_until(lk, now + loop_interval, [this]() { return check_leader.load(); }))
-        {
-            should_update = true;
-        }
-        else
         {
+            std::unique_lock<std::mutex> lk(update_leader_mutex);
+            update_leader_cv.wait_until(lk, next_update_time, [this]() { return check_leader.load() || work_threads_stop.load(); });
             if (work_threads_stop)
             {
                 return;
             }
-            if (std::chrono::system_clock::now() >= next_update_time)
-            {
-                should_update = true;
-                next_update_time = std::chrono::system_clock::now() + update_leader_interval;
-            }
         }
-        if (should_update)
+
+        check_leader.store(false);
+        try
         {
-            try
-            {
-                check_leader.store(false);
-                updateLeader();
-            }
-            catch (Exception & e)
-            {
-                log->error(e.displayText());
-            }
+            updateLeader();
+            next_update_time = std::chrono::steady_clock::now() + update_leader_interval;
+        }
+        catch (Exception & e)
+        {
+            log->error(e.displayText());
+            check_leader.store(true);
         }
+
+        // Requests failing against the old leader will ask for another update, ignore them for a while.
+        std::unique_lock<std::mutex> lk(update_leader_mutex);
+        if (update_leader_cv.wait_for(lk, update_leader_retry_interval, [this]() { return work_threads_stop.load(); }))
+        {
+            return;
+        }
+    }
+}
+
+void Client::asyncUpdateLeader()
+{
+    if (check_leader.exchange(true))
+    {
+        return;
+    }
+    {
+        // Pairs with the predicate check of the loop, so the wakeup can't be lost.
+        std::lock_guard<std::mutex> lk(update_leader_mutex);
     }
+    update_leader_cv.notify_one();
 }
 
 pdpb::RequestHeader * Client::requestHeader()
@@ -210,34 +232,163 @@ pdpb::RequestHeader * Client::requestHeader()
     return header;
 }
 
-uint64_t Client::getTS()
+uint64_t Client::getTS() { return getTSAsync().get(); }
+
+std::future<uint64_t> Client::getTSAsync()
+{
+    auto req = std::make_shared<TSORequest>();
+    req->enqueue_time = std::chrono::steady_clock::now();
+    auto future = req->promise.get_future();
+    {
+        std::lock_guard<std::mutex> lk(tso_mutex);
+        tso_queue.push_back(std::move(req));
+    }
+    tso_cv.notify_one();
+
+    // The request is already queued, only the wait is deferred to the caller of get().
+    return std::async(std::launch::deferred, [this, future = std::move(future)]() mutable {
+        if (future.wait_for(pd_timeout) != std::future_status::ready)
+        {
+            std::string err_msg = "get tso timeout";
+            log->error(err_msg);
+            asyncUpdateLeader();
+            // The dispatcher is probably stuck on a dead leader, break its read.
+            cancelTSOStream();
+            throw Exception(err_msg, GRPCErrorCode);
+        }
+        return future.get();
+    });
+}
+
+TSOStats Client::getTSOStats() const
+{
+    return TSOStats{tso_requests.load(), tso_batches.load(), tso_max_batch.load(), tso_wait_us.load()};
+}
+
+void Client::tsoLoop()
+{
+    std::vector<TSORequestPtr> batch;
+    for (;;)
+    {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lk(tso_mutex);
+            tso_cv.wait(lk, [this]() { return tso_stop || !tso_queue.empty(); });
+            if (tso_stop)
+            {
+                break;
+            }
+            size_t n = std::min(tso_queue.size(), tso_max_batch_size);
+            batch.assign(tso_queue.begin(), tso_queue.begin() + n);
+            tso_queue.erase(tso_queue.begin(), tso_queue.begin() + n);
+        }
+
+        try
+        {
+            uint64_t first = fetchTSBatch(batch.size());
+            auto now = std::chrono::steady_clock::now();
+            uint64_t wait_us = 0;
+            for (auto & req : batch)
+            {
+                wait_us += std::chrono::duration_cast<std::chrono::microseconds>(now - req->enqueue_time).count();
+            }
+            tso_requests += batch.size();
+            tso_batches++;
+            tso_wait_us += wait_us;
+            uint64_t max_size = tso_max_batch.load();
+            while (batch.size() > max_size && !tso_max_batch.compare_exchange_weak(max_size, batch.size()))
+                ;
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                batch[i]->promise.set_value(first + i);
+            }
+        }
+        catch (...)
+        {
+            auto e = std::current_exception();
+            for (auto & req : batch)
+            {
+                req->promise.set_exception(e);
+            }
+        }
+    }
+
+    resetTSOStream();
+    std::lock_guard<std::mutex> lk(tso_mutex);
+    for (auto & req : tso_queue)
+    {
+        req->promise.set_exception(std::make_exception_ptr(Exception("pd client is closed", GRPCErrorCode)));
+    }
+    tso_queue.clear();
+}
+
+uint64_t Client::fetchTSBatch(uint32_t count)
 {
+    if (tso_stream_stale.exchange(false))
+    {
+        resetTSOStream();
+    }
+    if (tso_stream == nullptr)
+    {
+        tso_stub = leaderStub();
+        {
+            // Publish the context first so that a timed out caller can cancel the stream setup.
+            std::lock_guard<std::mutex> lk(tso_mutex);
+            tso_context = std::make_unique<grpc::ClientContext>();
+        }
+        tso_stream = tso_stub->Tso(tso_context.get());
+    }
+
     pdpb::TsoRequest request{};
     pdpb::TsoResponse response{};
     request.set_allocated_header(requestHeader());
-    request.set_count(1);
+    request.set_count(count);
 
-    grpc::ClientContext context;
-
-    context.set_deadline(std::chrono::system_clock::now() + pd_timeout);
-
-    auto stream = leaderStub()->Tso(&context);
-    if (!stream->Write(request))
+    if (!tso_stream->Write(request) || !tso_stream->Read(&response))
     {
-        std::string err_msg = ("write tso failed\n ");
+        auto status = resetTSOStream();
+        std::string err_msg = "tso stream failed: " + std::to_string(status.error_code()) + ": " + status.error_message();
         log->error(err_msg);
-        check_leader.store(true);
+        asyncUpdateLeader();
         throw Exception(err_msg, GRPCErrorCode);
     }
-    if (!stream->Read(&response))
+    if (response.header().has_error() || response.count() != count)
     {
-        std::string err_msg = ("write tso failed\n ");
+        resetTSOStream();
+        std::string err_msg = "get tso failed: " + response.header().error().message() + ", requested "
+            + std::to_string(count) + " got " + std::to_string(response.count());
         log->error(err_msg);
-        check_leader.store(true);
+        asyncUpdateLeader();
         throw Exception(err_msg, GRPCErrorCode);
     }
+
+    // PD returns the last timestamp of the batch.
     auto ts = response.timestamp();
-    return (ts.physical() << 18) + ts.logical();
+    return (ts.physical() << 18) + ts.logical() - count + 1;
+}
+
+grpc::Status Client::resetTSOStream()
+{
+    grpc::Status status;
+    if (tso_stream != nullptr)
+    {
+        tso_context->TryCancel();
+        status = tso_stream->Finish();
+    }
+    std::lock_guard<std::mutex> lk(tso_mutex);
+    tso_stream.reset();
+    tso_context.reset();
+    tso_stub.reset();
+    return status;
+}
+
+void Client::cancelTSOStream()
+{
+    std::lock_guard<std::mutex> lk(tso_mutex);
+    if (tso_context != nullptr)
+    {
+        tso_context->TryCancel();
+    }
 }
 
 uint64_t Client::getGCSafePoint()
@@ -256,7 +407,7 @@ uint64_t Client::getGCSafePoint()
     {
         err_msg = "get safe point failed: " + std::to_string(status.error_code()) + ": " + status.error_message();
         log->error(err_msg);
-        check_leader.store(true);
+        asyncUpdateLeader();
         throw Exception(err_msg, status.error_code());
     }
     return response.safe_point();
@@ -279,7 +430,7 @@ std::pair<metapb::Region, metapb::Peer> Client::getRegionByKey(const std::string
     {
         std::string err_msg = ("get region failed: " + std::to_string(status.error_code()) + " : " + status.error_message());
         log->error(err_msg);
-        check_leader.store(true);
+        asyncUpdateLeader();
         throw Exception(err_msg, GRPCErrorCode);
     }
 
@@ -305,7 +456,7 @@ std::pair<metapb::Region, metapb::Peer> Client::getRegionByID(uint64_t region_id
     {
         std::string err_msg = ("get region by id failed: " + std::to_string(status.error_code()) + ": " + status.error_message());
         log->error(err_msg);
-        check_leader.store(true);
+        asyncUpdateLeader();
         throw Exception(err_msg, GRPCErrorCode);
     }
 
@@ -315,6 +466,41 @@ std::pair<metapb::Region, metapb::Peer> Client::getRegionByID(uint64_t region_id
     return std::make_pair(response.region(), response.leader());
 }
 
+std::vector<std::pair<metapb::Region, metapb::Peer>> Client::scanRegions(
+    const std::string & start_key, const std::string & end_key, int limit)
+{
+    pdpb::ScanRegionsRequest request{};
+    pdpb::ScanRegionsResponse response{};
+
+    request.set_allocated_header(requestHeader());
+    request.set_start_key(start_key);
+    request.set_end_key(end_key);
+    request.set_limit(limit);
+
+    grpc::ClientContext context;
+
+    context.set_deadline(std::chrono::system_clock::now() + pd_timeout);
+
+    auto status = leaderStub()->ScanRegions(&context, request, &response);
+    if (!status.ok())
+    {
+        std::string err_msg = ("scan regions failed: " + std::to_string(status.error_code()) + ": " + status.error_message());
+        log->error(err_msg);
+        asyncUpdateLeader();
+        throw Exception(err_msg, GRPCErrorCode);
+    }
+
+    std::vector<std::pair<metapb::Region, metapb::Peer>> result;
+    result.reserve(response.region_metas_size());
+    for (int i = 0; i < response.region_metas_size(); i++)
+    {
+        // Old PD versions don't return the leaders.
+        metapb::Peer leader = i < response.leaders_size() ? response.leaders(i) : metapb::Peer();
+        result.emplace_back(response.region_metas(i), leader);
+    }
+    return result;
+}
+
 metapb::Store Client::getStore(uint64_t store_id)
 {
     pdpb::GetStoreRequest request{};
@@ -332,11 +518,34 @@ metapb::Store Client::getStore(uint64_t store_id)
     {
         std::string err_msg = ("get store failed: " + std::to_string(status.error_code()) + ": " + status.error_message());
         log->error(err_msg);
-        check_leader.store(true);
+        asyncUpdateLeader();
         throw Exception(err_msg, GRPCErrorCode);
     }
     return response.store();
 }
 
+std::vector<metapb::Store> Client::getAllStores()
+{
+    pdpb::GetAllStoresRequest request{};
+    pdpb::GetAllStoresResponse response{};
+
+    request.set_allocated_header(requestHeader());
+    request.set_exclude_tombstone_stores(true);
+
+    grpc::ClientContext context;
+
+    context.set_deadline(std::chrono::system_clock::now() + pd_timeout);
+
+    auto status = leaderStub()->GetAllStores(&context, request, &response);
+    if (!status.ok())
+    {
+        std::string err_msg = ("get all stores failed: " + std::to_string(status.error_code()) + ": " + status.error_message());
+        log->error(err_msg);
+        asyncUpdateLeader();
+        throw Exception(err_msg, GRPCErrorCode);
+    }
+    return std::vector<metapb::Store>(response.stores().begin(), response.stores().end());
+}
+
 } // namespace pd
 } // namespace pingcap
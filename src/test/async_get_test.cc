@@ -0,0 +1,231 @@
+#include "mock_tikv.h"
+#include "test_helper.h"
+
+#include <grpcpp/server_builder.h>
+#include <pingcap/Exception.h>
+#include <pingcap/kv/Snapshot.h>
+#include <pingcap/kv/Txn.h>
+
+#include <future>
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+class TestWithMockKVAsync : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mock_kv_cluster = mockkv::initCluster();
+        std::vector<std::string> pd_addrs = mock_kv_cluster->pd_addrs;
+
+        pd::ClientPtr pd_client = std::make_shared<pd::Client>(pd_addrs);
+        test_cluster = createCluster(pd_client);
+    }
+
+    mockkv::ClusterPtr mock_kv_cluster;
+
+    ClusterPtr test_cluster;
+};
+
+TEST_F(TestWithMockKVAsync, testAsyncGet)
+{
+    constexpr int key_num = 64;
+
+    Txn txn(test_cluster);
+    for (int i = 0; i < key_num; i++)
+    {
+        txn.set("key" + std::to_string(i), std::to_string(i));
+    }
+    txn.commit();
+
+    uint64_t version = test_cluster->pd_client->getTS();
+
+    std::vector<RpcCallPtr<kvrpcpb::GetRequest>> calls;
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < key_num; i++)
+    {
+        Backoffer bo(GetMaxBackoff);
+        std::string key = "key" + std::to_string(i);
+        auto loc = test_cluster->region_cache->locateKey(bo, key);
+        RegionClient client(test_cluster->region_cache, test_cluster->rpc_client, loc.region);
+
+        auto * req = new kvrpcpb::GetRequest();
+        req->set_key(key);
+        req->set_version(version);
+        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::GetRequest>>(req);
+        futures.push_back(client.sendReqToRegionAsync(bo, rpc_call));
+        calls.push_back(rpc_call);
+    }
+
+    for (int i = 0; i < key_num; i++)
+    {
+        futures[i].get();
+        ASSERT_EQ(calls[i]->getResp()->value(), std::to_string(i));
+    }
+}
+
+TEST_F(TestWithMockKVAsync, testAsyncGetInjectError)
+{
+    Txn txn(test_cluster);
+    txn.set("abc", "edf");
+    txn.commit();
+
+    mock_kv_cluster->updateFailPoint(mock_kv_cluster->stores[0].id, "server-is-busy", "2*return()");
+
+    Backoffer bo(GetMaxBackoff);
+    auto loc = test_cluster->region_cache->locateKey(bo, "abc");
+    RegionClient client(test_cluster->region_cache, test_cluster->rpc_client, loc.region);
+
+    auto * req = new kvrpcpb::GetRequest();
+    req->set_key("abc");
+    req->set_version(test_cluster->pd_client->getTS());
+    auto rpc_call = std::make_shared<RpcCall<kvrpcpb::GetRequest>>(req);
+
+    std::promise<std::exception_ptr> result;
+    client.sendReqToRegionAsync(bo, rpc_call, [&](std::exception_ptr err) { result.set_value(err); });
+
+    ASSERT_EQ(result.get_future().get(), nullptr);
+    ASSERT_EQ(rpc_call->getResp()->value(), "edf");
+}
+
+TEST_F(TestWithMockKVAsync, testHedgedGet)
+{
+    Txn txn(test_cluster);
+    txn.set("abc", "1");
+    txn.set("abd", "2");
+    txn.commit();
+
+    mock_kv_cluster->updateFailPoint(mock_kv_cluster->stores[0].id, "server-is-busy", "2*return()");
+
+    Snapshot snap(test_cluster->region_cache, test_cluster->rpc_client, test_cluster->pd_client->getTS());
+    snap.hedge_delay = std::chrono::milliseconds(1);
+
+    ASSERT_EQ(snap.Get("abc"), "1");
+    ASSERT_EQ(snap.Get("abd"), "2");
+}
+
+// HedgeTikv answers every get with its value. A slow one holds the get until it's canceled.
+class HedgeTikv : public tikvpb::Tikv::Service
+{
+public:
+    HedgeTikv(const std::string & value_, bool slow_) : value(value_), slow(slow_) {}
+
+    grpc::Status KvGet(grpc::ServerContext * context, const kvrpcpb::GetRequest * req, kvrpcpb::GetResponse * resp) override
+    {
+        if (req->context().replica_read())
+            replica_reads++;
+        if (slow)
+        {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (!context->IsCancelled() && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            canceled = context->IsCancelled();
+        }
+        resp->set_value(value);
+        return grpc::Status::OK;
+    }
+
+    std::string value;
+    bool slow;
+    std::atomic<int> replica_reads{0};
+    std::atomic<bool> canceled{false};
+};
+
+// HedgePDClient serves one region led by store 1 with a follower on store 2.
+class HedgePDClient : public pd::IClient
+{
+public:
+    HedgePDClient(const std::string & leader_addr_, const std::string & follower_addr_)
+        : leader_addr(leader_addr_), follower_addr(follower_addr_)
+    {}
+
+    uint64_t getTS() override { return 1; }
+
+    std::future<uint64_t> getTSAsync() override
+    {
+        std::promise<uint64_t> ts;
+        ts.set_value(1);
+        return ts.get_future();
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string &) override
+    {
+        metapb::Region meta;
+        meta.set_id(1);
+        meta.mutable_region_epoch()->set_conf_ver(1);
+        meta.mutable_region_epoch()->set_version(1);
+        for (uint64_t store_id = 1; store_id <= 2; store_id++)
+        {
+            auto * peer = meta.add_peers();
+            peer->set_id(10 + store_id);
+            peer->set_store_id(store_id);
+        }
+        return std::make_pair(meta, meta.peers(0));
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t) override { return getRegionByKey(""); }
+
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(const std::string &, const std::string &, int) override
+    {
+        return {getRegionByKey("")};
+    }
+
+    metapb::Store getStore(uint64_t store_id) override
+    {
+        metapb::Store store;
+        store.set_id(store_id);
+        store.set_address(store_id == 1 ? leader_addr : follower_addr);
+        return store;
+    }
+
+    std::vector<metapb::Store> getAllStores() override { return {getStore(1), getStore(2)}; }
+
+    uint64_t getGCSafePoint() override { return 0; }
+
+    bool isMock() override { return true; }
+
+private:
+    std::string leader_addr;
+    std::string follower_addr;
+};
+
+std::unique_ptr<grpc::Server> startTikv(HedgeTikv & service, std::string & addr)
+{
+    int port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+    builder.RegisterService(&service);
+    auto server = builder.BuildAndStart();
+    addr = "127.0.0.1:" + std::to_string(port);
+    return server;
+}
+
+TEST(HedgedGetTest, testReplicaWins)
+{
+    HedgeTikv leader("leader", true);
+    HedgeTikv follower("follower", false);
+    std::string leader_addr, follower_addr;
+    auto leader_server = startTikv(leader, leader_addr);
+    auto follower_server = startTikv(follower, follower_addr);
+
+    auto cluster = createCluster(std::make_shared<HedgePDClient>(leader_addr, follower_addr));
+    Snapshot snap(cluster->region_cache, cluster->rpc_client, 1);
+    snap.hedge_delay = std::chrono::milliseconds(10);
+
+    // The leader doesn't answer, so the get sent to the follower wins and the one to the leader is canceled.
+    ASSERT_EQ(snap.Get("abc"), "follower");
+    ASSERT_EQ(follower.replica_reads, 1);
+    for (int i = 0; i < 1000 && !leader.canceled; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    ASSERT_TRUE(leader.canceled);
+
+    leader_server->Shutdown();
+    follower_server->Shutdown();
+}
+
+} // namespace
@@ -0,0 +1,148 @@
+#include "mock_tikv.h"
+#include "test_helper.h"
+
+#include <grpcpp/server_builder.h>
+#include <pingcap/Exception.h>
+#include <pingcap/kv/BatchCommands.h>
+#include <pingcap/kv/Scanner.h>
+#include <pingcap/kv/Snapshot.h>
+#include <pingcap/kv/Txn.h>
+
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+class TestWithMockKVBatchCommands : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mock_kv_cluster = mockkv::initCluster();
+        std::vector<std::string> pd_addrs = mock_kv_cluster->pd_addrs;
+
+        pd::ClientPtr pd_client = std::make_shared<pd::Client>(pd_addrs);
+        test_cluster = createCluster(pd_client, true);
+    }
+
+    mockkv::ClusterPtr mock_kv_cluster;
+
+    ClusterPtr test_cluster;
+};
+
+TEST_F(TestWithMockKVBatchCommands, testConcurrentGet)
+{
+    constexpr int key_num = 32;
+    constexpr int thread_num = 8;
+
+    Txn txn(test_cluster);
+    for (int i = 0; i < key_num; i++)
+    {
+        txn.set("key" + std::to_string(i), std::to_string(i));
+    }
+    txn.commit();
+
+    Snapshot snap(test_cluster->region_cache, test_cluster->rpc_client, test_cluster->pd_client->getTS());
+
+    std::vector<std::thread> threads;
+    std::atomic<int> wrong(0);
+    for (int t = 0; t < thread_num; t++)
+    {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < key_num; i++)
+            {
+                if (snap.Get("key" + std::to_string(i)) != std::to_string(i))
+                    wrong++;
+            }
+        });
+    }
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+    ASSERT_EQ(wrong.load(), 0);
+
+    auto scanner = snap.Scan("key", "kez");
+    int count = 0;
+    while (scanner.valid)
+    {
+        count++;
+        scanner.next();
+    }
+    ASSERT_EQ(count, key_num);
+}
+
+TEST_F(TestWithMockKVBatchCommands, testGetInjectError)
+{
+    Txn txn(test_cluster);
+    txn.set("abc", "edf");
+    txn.commit();
+
+    mock_kv_cluster->updateFailPoint(mock_kv_cluster->stores[0].id, "io-timeout", "8*return()");
+    Snapshot snap(test_cluster->region_cache, test_cluster->rpc_client, test_cluster->pd_client->getTS());
+
+    ASSERT_EQ(snap.Get("abc"), "edf");
+}
+
+// OneShotTikv answers the first batch of every BatchCommands stream, then closes the stream.
+class OneShotTikv : public tikvpb::Tikv::Service
+{
+public:
+    grpc::Status BatchCommands(grpc::ServerContext *,
+        grpc::ServerReaderWriter<tikvpb::BatchCommandsResponse, tikvpb::BatchCommandsRequest> * stream) override
+    {
+        tikvpb::BatchCommandsRequest batch;
+        if (!stream->Read(&batch))
+            return grpc::Status::OK;
+        tikvpb::BatchCommandsResponse resp;
+        for (int i = 0; i < batch.requests_size(); i++)
+        {
+            resp.add_request_ids(batch.request_ids(i));
+            resp.add_responses()->mutable_get()->set_value("v");
+        }
+        stream->Write(resp);
+        return grpc::Status::OK;
+    }
+};
+
+tikvpb::BatchCommandsResponse::Response sendGet(BatchCommandsClient & client)
+{
+    tikvpb::BatchCommandsRequest::Request req;
+    req.mutable_get()->set_key("k");
+    return client.send(std::move(req), std::chrono::system_clock::now() + std::chrono::seconds(1));
+}
+
+TEST(BatchCommandsClientTest, testReconnectAfterStreamBroken)
+{
+    OneShotTikv service;
+    int port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+    builder.RegisterService(&service);
+    auto server = builder.BuildAndStart();
+
+    BatchCommandsClient client(grpc::CreateChannel("127.0.0.1:" + std::to_string(port), grpc::InsecureChannelCredentials()));
+    ASSERT_EQ(sendGet(client).get().value(), "v");
+
+    // The server has closed the stream. A request may still go to the broken stream and fail, but a later one must be
+    // sent on a new stream.
+    bool ok = false;
+    for (int i = 0; i < 10 && !ok; i++)
+    {
+        try
+        {
+            ok = sendGet(client).get().value() == "v";
+        }
+        catch (Exception &)
+        {
+        }
+    }
+    ASSERT_TRUE(ok);
+
+    server->Shutdown();
+}
+
+} // namespace
@@ -53,6 +53,31 @@ TEST_P(TestWithMockKV, testGetInjectError)
     ASSERT_EQ(result, "edf");
 }
 
+TEST_P(TestWithMockKV, testGetDeadlineExceeded)
+{
+    Txn txn(test_cluster);
+    txn.set("abc", "edf");
+    txn.commit();
+
+    // Keep failing much longer than the deadline.
+    mock_kv_cluster->updateFailPoint(mock_kv_cluster->stores[0].id, fail_point, "1000*return()");
+    Snapshot snap(test_cluster->region_cache, test_cluster->rpc_client, test_cluster->pd_client->getTS());
+
+    auto start = std::chrono::system_clock::now();
+    try
+    {
+        snap.Get("abc", start + std::chrono::milliseconds(500));
+        FAIL() << "get should exceed its deadline";
+    }
+    catch (const Exception & e)
+    {
+        ASSERT_EQ(e.code(), DeadlineExceeded);
+    }
+    ASSERT_LT(std::chrono::system_clock::now() - start, std::chrono::seconds(1));
+
+    mock_kv_cluster->updateFailPoint(mock_kv_cluster->stores[0].id, fail_point, "off");
+}
+
 INSTANTIATE_TEST_SUITE_P(RunGetWithInjectedErr, TestWithMockKV,
     testing::Values(
         std::make_tuple<char *, char *>("server-is-busy", "2*return()"), std::make_tuple<char *, char *>("io-timeout", "8*return()")));
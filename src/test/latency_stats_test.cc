@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <pingcap/kv/LatencyStats.h>
+
+namespace
+{
+
+using namespace pingcap::kv;
+using namespace std::chrono_literals;
+
+void recordN(LatencyHistogram & histogram, std::chrono::microseconds latency, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        histogram.record(latency);
+}
+
+TEST(LatencyStatsTest, testPercentile)
+{
+    LatencyHistogram histogram;
+    recordN(histogram, 1ms, 90);
+    recordN(histogram, 100ms, 10);
+    ASSERT_EQ(histogram.count(), 100);
+
+    // A percentile is the upper bound of a bucket, at most bucket_ratio above the samples in it.
+    ASSERT_GE(histogram.percentile(0.5), 1ms);
+    ASSERT_LT(histogram.percentile(0.5), 1250us);
+    ASSERT_EQ(histogram.percentile(0.9), histogram.percentile(0.5));
+    ASSERT_GE(histogram.percentile(0.91), 100ms);
+    ASSERT_LT(histogram.percentile(0.91), 125ms);
+    ASSERT_EQ(histogram.percentile(0.99), histogram.percentile(0.91));
+}
+
+TEST(LatencyStatsTest, testBucketBounds)
+{
+    // Latencies out of range fall into the first and the last bucket.
+    LatencyHistogram fast;
+    fast.record(1us);
+    ASSERT_EQ(fast.percentile(0.99), std::chrono::microseconds(int64_t(LatencyHistogram::min_bound_us)));
+
+    LatencyHistogram slow;
+    slow.record(64s);
+    LatencyHistogram slower;
+    slower.record(1h);
+    ASSERT_GE(slow.percentile(0.99), 63s);
+    ASSERT_EQ(slower.percentile(0.99), slow.percentile(0.99));
+}
+
+TEST(LatencyStatsTest, testDecay)
+{
+    LatencyHistogram histogram;
+    recordN(histogram, 1ms, LatencyHistogram::latency_decay_period - 1);
+    ASSERT_EQ(histogram.count(), LatencyHistogram::latency_decay_period - 1);
+    histogram.record(1ms);
+    ASSERT_EQ(histogram.count(), LatencyHistogram::latency_decay_period / 2);
+
+    // After another period, the recent samples outweigh the old ones two to one.
+    recordN(histogram, 100ms, LatencyHistogram::latency_decay_period);
+    ASSERT_EQ(histogram.count(), LatencyHistogram::latency_decay_period / 4 * 3);
+    ASSERT_LT(histogram.percentile(0.3), 1250us);
+    ASSERT_GE(histogram.percentile(0.4), 100ms);
+}
+
+TEST(LatencyStatsTest, testTimeout)
+{
+    StoreLatency latency;
+    for (size_t i = 0; i < adaptive_timeout_min_samples - 1; i++)
+        latency.record(rpcGet, 100ms);
+    // Too few samples.
+    ASSERT_EQ(latency.timeout(rpcGet, 10s), 10s);
+
+    latency.record(rpcGet, 100ms);
+    auto timeout = latency.timeout(rpcGet, 10s);
+    ASSERT_GE(timeout, 100ms * adaptive_timeout_factor);
+    ASSERT_LT(timeout, 125ms * adaptive_timeout_factor);
+    ASSERT_EQ(latency.timeout(rpcGet, 200ms), 200ms);
+
+    // The histograms of the rpc types are apart.
+    ASSERT_EQ(latency.timeout(rpcCommit, 10s), 10s);
+    for (size_t i = 0; i < adaptive_timeout_min_samples; i++)
+        latency.record(rpcCommit, 1ms);
+    ASSERT_EQ(latency.timeout(rpcCommit, 10s), adaptive_timeout_floor);
+}
+
+} // namespace
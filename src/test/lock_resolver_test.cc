@@ -0,0 +1,146 @@
+#include "mock_tikv.h"
+#include "test_helper.h"
+
+#include <pingcap/Exception.h>
+#include <pingcap/kv/Scanner.h>
+#include <pingcap/kv/Snapshot.h>
+#include <pingcap/kv/Txn.h>
+
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+class TestWithMockKVLockResolver : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mock_kv_cluster = mockkv::initCluster();
+        std::vector<std::string> pd_addrs = mock_kv_cluster->pd_addrs;
+
+        pd::ClientPtr pd_client = std::make_shared<pd::Client>(pd_addrs);
+        test_cluster = createCluster(pd_client);
+
+        Txn txn(test_cluster);
+        txn.set("abc", "old1");
+        txn.set("abd", "old2");
+        txn.commit();
+    }
+
+    // prewrite locks keys for a txn whose primary is the first key, like a client that crashed before committing.
+    void prewrite(const std::vector<std::string> & keys, const std::string & value, uint64_t start_ts, uint64_t ttl)
+    {
+        Backoffer bo(prewriteMaxBackoff);
+        for (const auto & key : keys)
+        {
+            auto rpc_call = std::make_shared<RpcCall<kvrpcpb::PrewriteRequest>>();
+            auto * req = rpc_call->getReq();
+            auto * mut = req->add_mutations();
+            mut->set_key(key);
+            mut->set_value(value);
+            req->set_primary_lock(keys[0]);
+            req->set_start_version(start_ts);
+            req->set_lock_ttl(ttl);
+            auto loc = test_cluster->region_cache->locateKey(bo, key);
+            RegionClient(test_cluster->region_cache, test_cluster->rpc_client, loc.region).sendReqToRegion(bo, rpc_call);
+            ASSERT_EQ(rpc_call->getResp()->errors_size(), 0);
+        }
+    }
+
+    // commitPrimary commits only the primary key, leaving the secondary locks behind.
+    void commitPrimary(const std::string & primary, uint64_t start_ts)
+    {
+        Backoffer bo(commitMaxBackoff);
+        auto rpc_call = std::make_shared<RpcCall<kvrpcpb::CommitRequest>>();
+        auto * req = rpc_call->getReq();
+        req->add_keys(primary);
+        req->set_start_version(start_ts);
+        req->set_commit_version(test_cluster->pd_client->getTS());
+        auto loc = test_cluster->region_cache->locateKey(bo, primary);
+        RegionClient(test_cluster->region_cache, test_cluster->rpc_client, loc.region).sendReqToRegion(bo, rpc_call);
+        ASSERT_FALSE(rpc_call->getResp()->has_error());
+    }
+
+    Snapshot snapshot()
+    {
+        Snapshot snap(test_cluster->region_cache, test_cluster->rpc_client, test_cluster->pd_client->getTS());
+        snap.lock_resolver = test_cluster->lock_resolver;
+        return snap;
+    }
+
+    std::vector<std::string> scanValues(Snapshot & snap)
+    {
+        std::vector<std::string> values;
+        auto scanner = snap.Scan("ab", "ac");
+        while (scanner.valid)
+        {
+            values.push_back(scanner.value());
+            scanner.next();
+        }
+        return values;
+    }
+
+    mockkv::ClusterPtr mock_kv_cluster;
+
+    ClusterPtr test_cluster;
+};
+
+TEST_F(TestWithMockKVLockResolver, testResolveRolledBackLock)
+{
+    prewrite({"abc", "abd"}, "new", test_cluster->pd_client->getTS(), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Without a lock resolver the lock is an error.
+    Snapshot plain(test_cluster->region_cache, test_cluster->rpc_client, test_cluster->pd_client->getTS());
+    ASSERT_THROW(plain.Get("abd"), Exception);
+
+    // The primary lock has expired, so the txn is rolled back.
+    Snapshot snap = snapshot();
+    ASSERT_EQ(snap.Get("abd"), "old2");
+    ASSERT_EQ(snap.BatchGetValues({"abc", "abd"}), std::vector<std::string>({"old1", "old2"}));
+    ASSERT_EQ(scanValues(snap), std::vector<std::string>({"old1", "old2"}));
+}
+
+TEST_F(TestWithMockKVLockResolver, testResolveCommittedLock)
+{
+    uint64_t start_ts = test_cluster->pd_client->getTS();
+    prewrite({"abc", "abd"}, "new", start_ts, 3000);
+    commitPrimary("abc", start_ts);
+
+    // The primary is committed, so the secondary lock is committed too, without waiting for it to expire.
+    Snapshot snap = snapshot();
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(snap.Get("abd"), "new");
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(3000));
+    ASSERT_EQ(snap.BatchGetValues({"abc", "abd"}), std::vector<std::string>({"new", "new"}));
+    ASSERT_EQ(scanValues(snap), std::vector<std::string>({"new", "new"}));
+}
+
+TEST_F(TestWithMockKVLockResolver, testWaitForLiveLock)
+{
+    auto start = std::chrono::steady_clock::now();
+    prewrite({"abc", "abd"}, "new", test_cluster->pd_client->getTS(), 300);
+
+    // The lock is alive, the read backs off until it expires and is rolled back.
+    Snapshot snap = snapshot();
+    ASSERT_EQ(snap.Get("abd"), "old2");
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(250));
+}
+
+TEST_F(TestWithMockKVLockResolver, testPrewriteOverForeignLock)
+{
+    prewrite({"abd"}, "new", test_cluster->pd_client->getTS(), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    Txn txn(test_cluster);
+    txn.set("abd", "mine");
+    ASSERT_NO_THROW(txn.commit());
+
+    ASSERT_EQ(snapshot().Get("abd"), "mine");
+}
+
+} // namespace
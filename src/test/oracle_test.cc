@@ -0,0 +1,86 @@
+#include "test_helper.h"
+
+#include <pingcap/kv/Snapshot.h>
+#include <pingcap/pd/MockPDClient.h>
+#include <pingcap/pd/Oracle.h>
+
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+// CountingPDClient returns the timestamp set by the test, and counts the requests.
+class CountingPDClient : public pd::MockPDClient
+{
+public:
+    uint64_t getTS() override
+    {
+        calls++;
+        return ts;
+    }
+
+    std::atomic<uint64_t> ts{100};
+    std::atomic<int> calls{0};
+};
+
+class OracleTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        pd_client = std::make_shared<CountingPDClient>();
+        oracle = std::make_shared<pd::Oracle>(pd_client, std::chrono::milliseconds(500));
+        // Wait for the first update of the background thread, the next one is update_interval later.
+        for (int i = 0; i < 100 && oracle->getLowResolutionTimestamp() == 0; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ASSERT_EQ(oracle->getLowResolutionTimestamp(), 100);
+    }
+
+    std::shared_ptr<CountingPDClient> pd_client;
+
+    pd::OraclePtr oracle;
+};
+
+TEST_F(OracleTest, testCachedTimestamp)
+{
+    int calls = pd_client->calls;
+    pd_client->ts = 200;
+    ASSERT_EQ(oracle->getStaleTimestamp(std::chrono::seconds(10)), 100);
+
+    auto cache = std::make_shared<RegionCache>(pd_client, "zone", "engine");
+    auto snap = Snapshot::boundedStaleness(cache, std::make_shared<RpcClient>(), oracle, std::chrono::seconds(10));
+    ASSERT_EQ(snap.version, 100);
+    ASSERT_EQ(pd_client->calls, calls);
+}
+
+TEST_F(OracleTest, testStaleTimestamp)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int calls = pd_client->calls;
+    pd_client->ts = 200;
+    ASSERT_EQ(oracle->getStaleTimestamp(std::chrono::milliseconds(10)), 200);
+    ASSERT_EQ(pd_client->calls, calls + 1);
+
+    // The fetched timestamp is cached for the next reads.
+    ASSERT_EQ(oracle->getLowResolutionTimestamp(), 200);
+    ASSERT_EQ(oracle->getStaleTimestamp(std::chrono::seconds(10)), 200);
+    ASSERT_EQ(pd_client->calls, calls + 1);
+}
+
+TEST_F(OracleTest, testTimestampNeverGoesBack)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pd_client->ts = 300;
+    ASSERT_EQ(oracle->getStaleTimestamp(std::chrono::milliseconds(10)), 300);
+
+    // An older timestamp fetched later, like one from a request that took long, doesn't replace the newer one.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pd_client->ts = 200;
+    ASSERT_EQ(oracle->getStaleTimestamp(std::chrono::milliseconds(10)), 200);
+    ASSERT_EQ(oracle->getLowResolutionTimestamp(), 300);
+}
+
+} // namespace
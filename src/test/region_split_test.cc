@@ -6,7 +6,9 @@
 #include <pingcap/kv/Snapshot.h>
 #include <pingcap/kv/Txn.h>
 
+#include <cstdio>
 #include <iostream>
+#include <thread>
 
 namespace
 {
@@ -99,4 +101,91 @@ TEST_F(TestWithMockKVRegionSplit, testSplitRegionScan)
     ASSERT_EQ(answer, 6);
 }
 
+TEST_F(TestWithMockKVRegionSplit, testSplitRegionBatchGet)
+{
+    Txn txn(test_cluster);
+
+    txn.set("abc", "1");
+    txn.set("abd", "2");
+    txn.set("abf", "4");
+    txn.set("abz", "6");
+    txn.commit();
+
+    Snapshot snap(test_cluster->region_cache, test_cluster->rpc_client, test_cluster->pd_client->getTS());
+
+    std::vector<std::string> keys{"abz", "abc", "abe", "abf", "abd", "abc"};
+    auto result = snap.BatchGet(keys);
+    ASSERT_EQ(result.size(), 4);
+    ASSERT_EQ(result["abf"], "4");
+
+    // The cached region is stale now, the keys of the failed request are grouped again.
+    control_cluster->splitRegion("abf");
+
+    auto values = snap.BatchGetValues(keys);
+    ASSERT_EQ(values, std::vector<std::string>({"6", "1", "", "4", "2", "1"}));
+}
+
+TEST_F(TestWithMockKVRegionSplit, testConcurrentRegionLoad)
+{
+    control_cluster->splitRegion("abf");
+
+    auto & cache = test_cluster->region_cache;
+    Backoffer bo(10000);
+    auto loc = cache->locateKey(bo, "abc");
+    cache->dropRegion(loc.region);
+    uint64_t loads = cache->regionLoadCount();
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 16; i++)
+    {
+        threads.emplace_back([&, i]() {
+            Backoffer bo(10000);
+            auto key = "abc" + std::to_string(i);
+            ASSERT_TRUE(cache->locateKey(bo, key).contains(key));
+        });
+    }
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+
+    // All the keys are in the dropped region, so the misses share one load: the others join it while it is in flight,
+    // or find its result in the cache.
+    ASSERT_EQ(cache->regionLoadCount() - loads, 1);
+}
+
+TEST_F(TestWithMockKVRegionSplit, testRegionCacheEviction)
+{
+    control_cluster->splitRegion("abf");
+
+    auto cache = std::make_shared<RegionCache>(test_cluster->pd_client, "zone", "engine", 1);
+    Backoffer bo(10000);
+    cache->locateKey(bo, "abc");
+    cache->locateKey(bo, "abz");
+    cache->locateKey(bo, "abz");
+
+    auto stats = cache->stats();
+    ASSERT_EQ(stats.size, 1);
+    ASSERT_EQ(stats.hits, 1);
+    ASSERT_EQ(stats.misses, 2);
+    ASSERT_EQ(stats.evictions, 1);
+}
+
+TEST_F(TestWithMockKVRegionSplit, testRegionCacheSnapshot)
+{
+    control_cluster->splitRegion("abf");
+
+    std::string path = "region_cache_snapshot_test";
+    Backoffer bo(10000);
+    test_cluster->region_cache->locateKey(bo, "abc");
+    test_cluster->region_cache->locateKey(bo, "abz");
+    ASSERT_TRUE(test_cluster->region_cache->saveSnapshot(path));
+
+    auto cache = std::make_shared<RegionCache>(test_cluster->pd_client, "zone", "engine");
+    ASSERT_EQ(cache->loadSnapshot(path), 2);
+    ASSERT_EQ(cache->locateKey(bo, "abd").end_key, "abf");
+    ASSERT_EQ(cache->stats().misses, 0);
+    std::remove(path.c_str());
+}
+
 } // namespace
@@ -0,0 +1,233 @@
+#include "mock_tikv.h"
+#include "test_helper.h"
+
+#include <pingcap/Exception.h>
+#include <pingcap/kv/Scanner.h>
+#include <pingcap/kv/Snapshot.h>
+#include <pingcap/kv/Txn.h>
+
+#include <set>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+metapb::Store makeStore(uint64_t id, const std::string & addr, const std::string & zone)
+{
+    metapb::Store store;
+    store.set_id(id);
+    store.set_address(addr);
+    auto * label = store.add_labels();
+    label->set_key("zone");
+    label->set_value(zone);
+    return store;
+}
+
+// LabeledPDClient serves one region led by store 1, with followers on stores 2, 3 and 4 in zones z1, z2 and z2.
+class LabeledPDClient : public pd::IClient
+{
+public:
+    uint64_t getTS() override { return 0; }
+
+    std::future<uint64_t> getTSAsync() override
+    {
+        std::promise<uint64_t> ts;
+        ts.set_value(0);
+        return ts.get_future();
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string &) override
+    {
+        metapb::Region meta;
+        meta.set_id(1);
+        meta.mutable_region_epoch()->set_conf_ver(1);
+        meta.mutable_region_epoch()->set_version(1);
+        for (uint64_t store_id = 1; store_id <= 4; store_id++)
+        {
+            auto * peer = meta.add_peers();
+            peer->set_id(10 + store_id);
+            peer->set_store_id(store_id);
+        }
+        return std::make_pair(meta, meta.peers(0));
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t) override { return getRegionByKey(""); }
+
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(const std::string &, const std::string &, int) override
+    {
+        return {getRegionByKey("")};
+    }
+
+    metapb::Store getStore(uint64_t store_id) override
+    {
+        return makeStore(store_id, "127.0.0.1:" + std::to_string(20160 + store_id), store_id <= 2 ? "z1" : "z2");
+    }
+
+    std::vector<metapb::Store> getAllStores() override { return {getStore(1), getStore(2), getStore(3), getStore(4)}; }
+
+    uint64_t getGCSafePoint() override { return 0; }
+
+    bool isMock() override { return true; }
+};
+
+TEST(ReplicaReadTest, testPreferLabeledReplica)
+{
+    auto cache = std::make_shared<RegionCache>(std::make_shared<LabeledPDClient>(), "zone", "engine");
+    Backoffer bo(10000);
+    auto region = cache->locateKey(bo, "abc").region;
+
+    std::set<uint64_t> nearest;
+    for (int i = 0; i < 8; i++)
+    {
+        nearest.insert(cache->getReplicaRPCContext(bo, region, "zone", "z2")->peer.store_id());
+    }
+    ASSERT_EQ(nearest, std::set<uint64_t>({3, 4}));
+
+    // Without a replica in the zone, any follower may serve, but never the leader.
+    std::set<uint64_t> any;
+    for (int i = 0; i < 9; i++)
+    {
+        any.insert(cache->getReplicaRPCContext(bo, region, "zone", "z9")->peer.store_id());
+    }
+    ASSERT_EQ(any, std::set<uint64_t>({2, 3, 4}));
+}
+
+TEST(ReplicaReadTest, testSkipFailedReplica)
+{
+    auto cache = std::make_shared<RegionCache>(std::make_shared<LabeledPDClient>(), "zone", "engine");
+    Backoffer bo(10000);
+    auto region = cache->locateKey(bo, "abc").region;
+
+    // The contexts are built once and reused.
+    std::map<uint64_t, RPCContextPtr> contexts;
+    for (int i = 0; i < 4; i++)
+    {
+        auto ctx = cache->getReplicaRPCContext(bo, region, "zone", "z2");
+        auto it = contexts.emplace(ctx->peer.store_id(), ctx).first;
+        ASSERT_EQ(it->second, ctx);
+    }
+    ASSERT_EQ(contexts.size(), 2);
+
+    // A failed replica is skipped, the other replicas are still reused.
+    cache->onReplicaSendReqFail(*contexts[3]);
+    for (int i = 0; i < 4; i++)
+    {
+        auto ctx = cache->getReplicaRPCContext(bo, region, "zone", "z2");
+        ASSERT_EQ(ctx->peer.store_id(), 4);
+        contexts[4] = ctx;
+    }
+    ASSERT_EQ(cache->getReplicaRPCContext(bo, region, "zone", "z2"), contexts[4]);
+}
+
+// UnreachableReplicaPDClient is the PD of the mock cluster, but every region also has a follower on a store that
+// nothing listens on.
+class UnreachableReplicaPDClient : public pd::IClient
+{
+public:
+    static constexpr uint64_t replica_store_id = 1000;
+
+    explicit UnreachableReplicaPDClient(pd::ClientPtr pd_client_) : pd_client(pd_client_) {}
+
+    uint64_t getTS() override { return pd_client->getTS(); }
+
+    std::future<uint64_t> getTSAsync() override { return pd_client->getTSAsync(); }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string & key) override
+    {
+        return addReplica(pd_client->getRegionByKey(key));
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t region_id) override
+    {
+        return addReplica(pd_client->getRegionByID(region_id));
+    }
+
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(
+        const std::string & start_key, const std::string & end_key, int limit) override
+    {
+        auto regions = pd_client->scanRegions(start_key, end_key, limit);
+        for (auto & region : regions)
+        {
+            region = addReplica(std::move(region));
+        }
+        return regions;
+    }
+
+    metapb::Store getStore(uint64_t store_id) override
+    {
+        if (store_id == replica_store_id)
+            return makeStore(store_id, "127.0.0.1:1", "z1");
+        return pd_client->getStore(store_id);
+    }
+
+    std::vector<metapb::Store> getAllStores() override
+    {
+        auto stores = pd_client->getAllStores();
+        stores.push_back(getStore(replica_store_id));
+        return stores;
+    }
+
+    uint64_t getGCSafePoint() override { return pd_client->getGCSafePoint(); }
+
+    bool isMock() override { return pd_client->isMock(); }
+
+private:
+    static std::pair<metapb::Region, metapb::Peer> addReplica(std::pair<metapb::Region, metapb::Peer> region)
+    {
+        // The leader stays the first peer.
+        auto * peer = region.first.add_peers();
+        peer->set_id(region.first.id() + replica_store_id);
+        peer->set_store_id(replica_store_id);
+        return region;
+    }
+
+    pd::ClientPtr pd_client;
+};
+
+class TestWithMockKVReplicaRead : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mock_kv_cluster = mockkv::initCluster();
+        std::vector<std::string> pd_addrs = mock_kv_cluster->pd_addrs;
+
+        pd::ClientPtr pd_client = std::make_shared<pd::Client>(pd_addrs);
+        test_cluster = createCluster(pd_client);
+        replica_cluster = createCluster(std::make_shared<UnreachableReplicaPDClient>(pd_client));
+    }
+
+    mockkv::ClusterPtr mock_kv_cluster;
+
+    ClusterPtr test_cluster;
+    ClusterPtr replica_cluster;
+};
+
+TEST_F(TestWithMockKVReplicaRead, testFallbackToLeader)
+{
+    Txn txn(test_cluster);
+    txn.set("abc", "1");
+    txn.set("abd", "2");
+    txn.set("abz", "6");
+    txn.commit();
+
+    Snapshot snap(replica_cluster->region_cache, replica_cluster->rpc_client, test_cluster->pd_client->getTS());
+    snap.replica_read.enabled = true;
+
+    // The only replica is unreachable, so every read is served by the leader.
+    ASSERT_EQ(snap.Get("abd"), "2");
+    ASSERT_EQ(snap.BatchGetValues({"abz", "abc", "abe"}), std::vector<std::string>({"6", "1", ""}));
+
+    auto scanner = snap.Scan("ab", "ac");
+    std::vector<std::string> values;
+    while (scanner.valid)
+    {
+        values.push_back(scanner.value());
+        scanner.next();
+    }
+    ASSERT_EQ(values, std::vector<std::string>({"1", "2", "6"}));
+}
+
+} // namespace
@@ -0,0 +1,205 @@
+// Counts heap allocations of one request/response cycle of RpcCall, with and without arena, and of getting the
+// context of a request from RegionCache. The response is parsed from bytes the same way grpc deserializes it, and the
+// region comes from a fake pd, so no cluster is needed.
+
+#include <pingcap/kv/Region.h>
+#include <pingcap/kv/Rpc.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+namespace
+{
+std::atomic<size_t> alloc_count(0);
+}
+
+void * operator new(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    if (void * p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void * p) noexcept { std::free(p); }
+
+void operator delete(void * p, size_t) noexcept { std::free(p); }
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+constexpr int rounds = 1000;
+constexpr int retries = 2;
+
+RPCContextPtr makeContext()
+{
+    metapb::Region meta;
+    meta.set_id(1);
+    meta.mutable_region_epoch()->set_conf_ver(1);
+    meta.mutable_region_epoch()->set_version(1);
+    auto * peer = meta.add_peers();
+    peer->set_id(2);
+    peer->set_store_id(3);
+    return std::make_shared<RPCContext>(RegionVerID(1, 1, 1), meta, *peer, "127.0.0.1:20160");
+}
+
+std::string getResponse()
+{
+    kvrpcpb::GetResponse resp;
+    resp.set_value(std::string(64, 'v'));
+    return resp.SerializeAsString();
+}
+
+std::string scanResponse()
+{
+    kvrpcpb::ScanResponse resp;
+    for (int i = 0; i < 256; i++)
+    {
+        auto * pair = resp.add_pairs();
+        pair->set_key("key_" + std::to_string(i) + std::string(32, 'k'));
+        pair->set_value(std::string(64, 'v'));
+    }
+    return resp.SerializeAsString();
+}
+
+// FakePDClient knows a single region and a single store.
+class FakePDClient : public pd::IClient
+{
+public:
+    uint64_t getTS() override { return 0; }
+
+    std::future<uint64_t> getTSAsync() override
+    {
+        std::promise<uint64_t> ts;
+        ts.set_value(0);
+        return ts.get_future();
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string &) override
+    {
+        metapb::Region meta;
+        meta.set_id(1);
+        meta.mutable_region_epoch()->set_conf_ver(1);
+        meta.mutable_region_epoch()->set_version(1);
+        auto * peer = meta.add_peers();
+        peer->set_id(2);
+        peer->set_store_id(3);
+        return std::make_pair(meta, *peer);
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t) override { return getRegionByKey(""); }
+
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(const std::string &, const std::string &, int) override
+    {
+        return {getRegionByKey("")};
+    }
+
+    metapb::Store getStore(uint64_t store_id) override
+    {
+        metapb::Store store;
+        store.set_id(store_id);
+        store.set_address("127.0.0.1:20160");
+        auto * label = store.add_labels();
+        label->set_key("zone");
+        label->set_value("z1");
+        return store;
+    }
+
+    std::vector<metapb::Store> getAllStores() override { return {getStore(3)}; }
+
+    uint64_t getGCSafePoint() override { return 0; }
+
+    bool isMock() override { return true; }
+};
+
+template <class T>
+void fill(T * req);
+
+template <>
+void fill(kvrpcpb::GetRequest * req)
+{
+    req->set_key("key_1");
+    req->set_version(100);
+}
+
+template <>
+void fill(kvrpcpb::ScanRequest * req)
+{
+    req->set_start_key("key_");
+    req->set_end_key("kez");
+    req->set_limit(256);
+    req->set_version(100);
+}
+
+template <class T>
+void run(const std::string & name, const std::string & resp_bytes, bool use_arena)
+{
+    auto ctx = makeContext();
+    size_t before = alloc_count.load();
+    for (int i = 0; i < rounds; i++)
+    {
+        std::shared_ptr<RpcCall<T>> rpc;
+        if (use_arena)
+        {
+            rpc = std::make_shared<RpcCall<T>>();
+        }
+        else
+        {
+            rpc = std::make_shared<RpcCall<T>>(new T());
+        }
+        fill(rpc->getReq());
+        for (int j = 0; j < retries; j++)
+        {
+            rpc->setCtx(ctx);
+            rpc->getResp()->ParseFromString(resp_bytes);
+        }
+    }
+    size_t allocs = alloc_count.load() - before;
+    std::cout << name << (use_arena ? " arena" : " heap ") << ": " << double(allocs) / rounds << " allocations per call" << std::endl;
+}
+
+// runContext measures RegionCache::getRPCContext followed by RpcCall::setCtx on an arena request. With rebuild set, it
+// builds the context per request instead, like the cache used to do.
+void runContext(bool rebuild)
+{
+    auto cache = std::make_shared<RegionCache>(std::make_shared<FakePDClient>(), "engine", "tiflash");
+    Backoffer bo(1000);
+    auto id = cache->locateKey(bo, "key_1").region;
+    auto rpc = std::make_shared<RpcCall<kvrpcpb::GetRequest>>();
+    rpc->setCtx(cache->getRPCContext(bo, id));
+    size_t before = alloc_count.load();
+    for (int i = 0; i < rounds; i++)
+    {
+        auto ctx = cache->getRPCContext(bo, id);
+        if (rebuild)
+        {
+            auto store = cache->getStore(bo, ctx->peer.store_id());
+            ctx = std::make_shared<RPCContext>(id, cache->getRegionByID(bo, id)->meta, ctx->peer, store.addr);
+        }
+        rpc->setCtx(ctx);
+    }
+    size_t allocs = alloc_count.load() - before;
+    std::cout << "Context" << (rebuild ? " rebuilt" : " cached ") << ": " << double(allocs) / rounds << " allocations per call"
+              << std::endl;
+}
+
+} // namespace
+
+int main()
+{
+    auto get_resp = getResponse();
+    auto scan_resp = scanResponse();
+    for (bool use_arena : {false, true})
+    {
+        run<kvrpcpb::GetRequest>("Get ", get_resp, use_arena);
+        run<kvrpcpb::ScanRequest>("Scan", scan_resp, use_arena);
+    }
+    runContext(true);
+    runContext(false);
+    return 0;
+}
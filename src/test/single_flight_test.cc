@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <pingcap/kv/SingleFlight.h>
+
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap::kv;
+
+TEST(SingleFlightTest, testShareInflightCall)
+{
+    constexpr int thread_num = 8;
+
+    SingleFlight<std::string, int> flights;
+    std::atomic<int> executed(0);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+
+    std::vector<std::thread> threads;
+    std::vector<int> results(thread_num);
+    for (int i = 0; i < thread_num; i++)
+    {
+        threads.emplace_back([&, i]() {
+            results[i] = flights.run("key", [&]() {
+                executed++;
+                released.wait();
+                return 42;
+            });
+        });
+    }
+    // Let all the other threads join the first call before it finishes. A call is counted as shared only once it has
+    // found the call in flight.
+    while (flights.sharedCount() < thread_num - 1)
+        std::this_thread::yield();
+    release.set_value();
+    for (auto & thread : threads)
+        thread.join();
+
+    ASSERT_EQ(executed.load(), 1);
+    ASSERT_EQ(flights.sharedCount(), thread_num - 1);
+    for (int result : results)
+        ASSERT_EQ(result, 42);
+
+    // The key is forgotten once the call is done.
+    ASSERT_EQ(flights.run("key", []() { return 7; }), 7);
+}
+
+TEST(SingleFlightTest, testShareException)
+{
+    constexpr int thread_num = 4;
+
+    SingleFlight<std::string, int> flights;
+    std::atomic<int> executed(0);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+
+    std::vector<std::thread> threads;
+    std::atomic<int> failed(0);
+    for (int i = 0; i < thread_num; i++)
+    {
+        threads.emplace_back([&]() {
+            try
+            {
+                flights.run("key", [&]() -> int {
+                    executed++;
+                    released.wait();
+                    throw std::runtime_error("failed");
+                });
+            }
+            catch (const std::runtime_error &)
+            {
+                failed++;
+            }
+        });
+    }
+    while (flights.sharedCount() < thread_num - 1)
+        std::this_thread::yield();
+    release.set_value();
+    for (auto & thread : threads)
+        thread.join();
+
+    ASSERT_EQ(executed.load(), 1);
+    ASSERT_EQ(failed.load(), thread_num);
+
+    // A failed call is not remembered either.
+    ASSERT_EQ(flights.run("key", []() { return 1; }), 1);
+}
+
+} // namespace
@@ -0,0 +1,176 @@
+#include "test_helper.h"
+
+#include <grpcpp/server_builder.h>
+#include <pingcap/Exception.h>
+#include <pingcap/kv/Snapshot.h>
+#include <pingcap/kv/SnapshotCache.h>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+TEST(SnapshotCacheTest, testHitAndEvict)
+{
+    // 16 shards of 128 bytes, each holds one entry of this size.
+    SnapshotCache cache(1, 16 * 128);
+
+    std::string value;
+    ASSERT_FALSE(cache.get("a", value));
+    cache.put("a", std::string(50, 'x'));
+    cache.put("b", "");
+    ASSERT_TRUE(cache.get("a", value));
+    ASSERT_EQ(value, std::string(50, 'x'));
+    ASSERT_TRUE(cache.get("b", value));
+    ASSERT_EQ(value, "");
+
+    for (int i = 0; i < 1000; i++)
+        cache.put("key" + std::to_string(i), std::string(50, 'y'));
+
+    auto stats = cache.stats();
+    ASSERT_LE(stats.bytes, 16 * 128);
+    ASSERT_LE(stats.size, 16);
+    ASSERT_EQ(stats.hits, 2);
+    ASSERT_EQ(stats.misses, 1);
+    ASSERT_DOUBLE_EQ(stats.hitRate(), 2.0 / 3);
+
+    // An entry larger than a shard is not cached.
+    cache.put("big", std::string(1000, 'z'));
+    ASSERT_FALSE(cache.get("big", value));
+}
+
+// CountingTikv serves the keys "a" and "b", and counts the gets.
+class CountingTikv : public tikvpb::Tikv::Service
+{
+public:
+    grpc::Status KvGet(grpc::ServerContext *, const kvrpcpb::GetRequest * req, kvrpcpb::GetResponse * resp) override
+    {
+        gets++;
+        auto it = values.find(req->key());
+        if (it == values.end())
+            resp->set_not_found(true);
+        else
+            resp->set_value(it->second);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status KvBatchGet(grpc::ServerContext *, const kvrpcpb::BatchGetRequest * req, kvrpcpb::BatchGetResponse * resp) override
+    {
+        batch_gets++;
+        for (const auto & key : req->keys())
+        {
+            auto it = values.find(key);
+            if (it == values.end())
+                continue;
+            auto * pair = resp->add_pairs();
+            pair->set_key(key);
+            pair->set_value(it->second);
+        }
+        return grpc::Status::OK;
+    }
+
+    std::map<std::string, std::string> values{{"a", "1"}, {"b", "2"}};
+    std::atomic<int> gets{0};
+    std::atomic<int> batch_gets{0};
+};
+
+// SingleStorePDClient serves one region on the store at addr.
+class SingleStorePDClient : public pd::IClient
+{
+public:
+    explicit SingleStorePDClient(const std::string & addr_) : addr(addr_) {}
+
+    uint64_t getTS() override { return 1; }
+
+    std::future<uint64_t> getTSAsync() override
+    {
+        std::promise<uint64_t> ts;
+        ts.set_value(1);
+        return ts.get_future();
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string &) override
+    {
+        metapb::Region meta;
+        meta.set_id(1);
+        meta.mutable_region_epoch()->set_conf_ver(1);
+        meta.mutable_region_epoch()->set_version(1);
+        auto * peer = meta.add_peers();
+        peer->set_id(11);
+        peer->set_store_id(1);
+        return std::make_pair(meta, meta.peers(0));
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t) override { return getRegionByKey(""); }
+
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(const std::string &, const std::string &, int) override
+    {
+        return {getRegionByKey("")};
+    }
+
+    metapb::Store getStore(uint64_t store_id) override
+    {
+        metapb::Store store;
+        store.set_id(store_id);
+        store.set_address(addr);
+        return store;
+    }
+
+    std::vector<metapb::Store> getAllStores() override { return {getStore(1)}; }
+
+    uint64_t getGCSafePoint() override { return 0; }
+
+    bool isMock() override { return true; }
+
+private:
+    std::string addr;
+};
+
+TEST(SnapshotCacheTest, testSnapshotReadCache)
+{
+    CountingTikv service;
+    int port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+    builder.RegisterService(&service);
+    auto server = builder.BuildAndStart();
+
+    auto cluster = createCluster(std::make_shared<SingleStorePDClient>("127.0.0.1:" + std::to_string(port)));
+    auto read_cache = std::make_shared<SnapshotCache>(1, 1 << 20);
+    Snapshot snap(cluster->region_cache, cluster->rpc_client, 1);
+    snap.read_cache = read_cache;
+
+    ASSERT_EQ(snap.Get("a"), "1");
+    ASSERT_EQ(snap.Get("c"), "");
+    ASSERT_EQ(service.gets, 2);
+
+    // Read again, a missing key included, without a request.
+    ASSERT_EQ(snap.Get("a"), "1");
+    ASSERT_EQ(snap.Get("c"), "");
+    ASSERT_EQ(service.gets, 2);
+
+    // Only the key not read yet is sent.
+    ASSERT_EQ(snap.BatchGetValues({"a", "b", "c"}), std::vector<std::string>({"1", "2", ""}));
+    ASSERT_EQ(service.batch_gets, 1);
+    ASSERT_EQ(snap.BatchGetValues({"c", "b", "a"}), std::vector<std::string>({"", "2", "1"}));
+    ASSERT_EQ(service.batch_gets, 1);
+
+    // Another snapshot at the same version shares the cache.
+    Snapshot same(cluster->region_cache, cluster->rpc_client, 1);
+    same.read_cache = read_cache;
+    ASSERT_EQ(same.Get("b"), "2");
+    ASSERT_EQ(service.gets, 2);
+
+    // A snapshot at another version must not read it.
+    Snapshot other(cluster->region_cache, cluster->rpc_client, 2);
+    other.read_cache = read_cache;
+    ASSERT_THROW(other.Get("a"), Exception);
+    ASSERT_THROW(other.BatchGet({"a"}), Exception);
+    ASSERT_EQ(service.gets, 2);
+    ASSERT_EQ(service.batch_gets, 1);
+
+    server->Shutdown();
+}
+
+} // namespace
@@ -0,0 +1,26 @@
+#include <gtest/gtest.h>
+#include <pingcap/kv/StoreProber.h>
+
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap::kv;
+
+TEST(StoreProberTest, testUnreachableStore)
+{
+    auto rpc_client = std::make_shared<RpcClient>();
+    StoreProber prober(rpc_client, std::chrono::milliseconds(50));
+
+    // Nothing listens on the port.
+    std::string addr = "127.0.0.1:1";
+    ASSERT_TRUE(prober.isAlive(addr));
+    for (int i = 0; i < 100 && prober.isAlive(addr); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ASSERT_FALSE(prober.isAlive(addr));
+}
+
+} // namespace
@@ -0,0 +1,171 @@
+#include "test_helper.h"
+
+#include <pingcap/Exception.h>
+#include <pingcap/pd/MockPDClient.h>
+
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+// StoresPDClient serves one region led by store 1 with a follower on store 2. The stores can be moved or removed, and
+// the store requests are counted.
+class StoresPDClient : public pd::IClient
+{
+public:
+    StoresPDClient()
+    {
+        setStore(1, "127.0.0.1:20161");
+        setStore(2, "127.0.0.1:20162");
+    }
+
+    uint64_t getTS() override { return 0; }
+
+    std::future<uint64_t> getTSAsync() override
+    {
+        std::promise<uint64_t> ts;
+        ts.set_value(0);
+        return ts.get_future();
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByKey(const std::string &) override
+    {
+        metapb::Region meta;
+        meta.set_id(1);
+        meta.mutable_region_epoch()->set_conf_ver(1);
+        meta.mutable_region_epoch()->set_version(1);
+        for (uint64_t store_id = 1; store_id <= 2; store_id++)
+        {
+            auto * peer = meta.add_peers();
+            peer->set_id(10 + store_id);
+            peer->set_store_id(store_id);
+        }
+        return std::make_pair(meta, meta.peers(0));
+    }
+
+    std::pair<metapb::Region, metapb::Peer> getRegionByID(uint64_t) override { return getRegionByKey(""); }
+
+    std::vector<std::pair<metapb::Region, metapb::Peer>> scanRegions(const std::string &, const std::string &, int) override
+    {
+        return {getRegionByKey("")};
+    }
+
+    metapb::Store getStore(uint64_t store_id) override
+    {
+        store_calls++;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = stores.find(store_id);
+        if (it == stores.end())
+            throw Exception("store " + std::to_string(store_id) + " not found", StoreNotReady);
+        return it->second;
+    }
+
+    std::vector<metapb::Store> getAllStores() override
+    {
+        all_stores_calls++;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<metapb::Store> all;
+        for (const auto & [id, store] : stores)
+            all.push_back(store);
+        return all;
+    }
+
+    uint64_t getGCSafePoint() override { return 0; }
+
+    bool isMock() override { return true; }
+
+    void setStore(uint64_t store_id, const std::string & addr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stores[store_id].set_id(store_id);
+        stores[store_id].set_address(addr);
+    }
+
+    void removeStore(uint64_t store_id)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stores.erase(store_id);
+    }
+
+    std::atomic<int> store_calls{0};
+    std::atomic<int> all_stores_calls{0};
+
+private:
+    std::mutex mutex;
+    std::map<uint64_t, metapb::Store> stores;
+};
+
+TEST(StoreRefresherTest, testPreloadStores)
+{
+    auto pd_client = std::make_shared<StoresPDClient>();
+    auto cache = std::make_shared<RegionCache>(pd_client, "zone", "engine");
+    cache->startStoreRefresher();
+    ASSERT_EQ(pd_client->all_stores_calls, 1);
+
+    // The stores of the region are already cached.
+    Backoffer bo(10000);
+    auto region = cache->locateKey(bo, "abc").region;
+    ASSERT_EQ(cache->getRPCContext(bo, region)->addr, "127.0.0.1:20161");
+    ASSERT_EQ(cache->getReplicaRPCContext(bo, region)->addr, "127.0.0.1:20162");
+    ASSERT_EQ(pd_client->store_calls, 0);
+}
+
+TEST(StoreRefresherTest, testReloadMovedStores)
+{
+    auto pd_client = std::make_shared<StoresPDClient>();
+    auto cache = std::make_shared<RegionCache>(pd_client, "zone", "engine");
+    Backoffer bo(10000);
+    ASSERT_EQ(cache->loadAllStores(bo), 2);
+    auto region = cache->locateKey(bo, "abc").region;
+    auto ctx = cache->getRPCContext(bo, region);
+
+    // Nothing changed, the context is kept.
+    cache->loadAllStores(bo);
+    ASSERT_EQ(cache->getRPCContext(bo, region), ctx);
+
+    // A moved store is seen by the contexts built after the reload.
+    pd_client->setStore(1, "127.0.0.1:20171");
+    cache->loadAllStores(bo);
+    auto moved = cache->getRPCContext(bo, region);
+    ASSERT_EQ(moved->addr, "127.0.0.1:20171");
+    ASSERT_GT(moved->store_epoch, ctx->store_epoch);
+
+    // So is a removed one, even if it's not the store of the context.
+    pd_client->removeStore(2);
+    ASSERT_EQ(cache->loadAllStores(bo), 1);
+    auto removed = cache->getRPCContext(bo, region);
+    ASSERT_NE(removed, moved);
+    ASSERT_GT(removed->store_epoch, moved->store_epoch);
+    ASSERT_EQ(pd_client->store_calls, 0);
+}
+
+TEST(StoreRefresherTest, testStopRefresher)
+{
+    auto pd_client = std::make_shared<StoresPDClient>();
+    auto cache = std::make_shared<RegionCache>(pd_client, "zone", "engine");
+    cache->startStoreRefresher(std::chrono::seconds(1));
+    for (int i = 0; i < 300 && pd_client->all_stores_calls < 2; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_GE(pd_client->all_stores_calls, 2);
+
+    cache->stopStoreRefresher();
+    int calls = pd_client->all_stores_calls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    ASSERT_EQ(pd_client->all_stores_calls, calls);
+
+    // Stopping again is a no-op, and the refresher can be started again.
+    cache->stopStoreRefresher();
+    cache->startStoreRefresher(std::chrono::seconds(1));
+    ASSERT_EQ(pd_client->all_stores_calls, calls + 1);
+}
+
+TEST(StoreRefresherTest, testRefresherOnMockPD)
+{
+    auto cluster = createCluster(std::make_shared<pd::MockPDClient>());
+    ASSERT_NO_THROW(cluster->startStoreRefresher());
+}
+
+} // namespace
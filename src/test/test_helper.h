@@ -9,10 +9,10 @@ namespace {
 using namespace pingcap;
 using namespace pingcap::kv;
 
-inline ClusterPtr createCluster(pd::ClientPtr pd_client)
+inline ClusterPtr createCluster(pd::ClientPtr pd_client, bool enable_batch = false)
 {
     RegionCachePtr cache = std::make_shared<kv::RegionCache>(pd_client, "zone", "engine");
-    RpcClientPtr rpc = std::make_shared<kv::RpcClient>();
+    RpcClientPtr rpc = std::make_shared<kv::RpcClient>(enable_batch);
     return std::make_shared<Cluster>(pd_client, cache, rpc);
 }
 
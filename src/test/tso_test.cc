@@ -0,0 +1,151 @@
+#include "mock_tikv.h"
+#include "test_helper.h"
+
+#include <grpcpp/server_builder.h>
+#include <pingcap/Exception.h>
+#include <pingcap/pd/Client.h>
+
+#include <set>
+#include <thread>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+class TestWithMockKVTSO : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        mock_kv_cluster = mockkv::initCluster();
+        pd_client = std::make_shared<pd::Client>(mock_kv_cluster->pd_addrs);
+    }
+
+    mockkv::ClusterPtr mock_kv_cluster;
+
+    std::shared_ptr<pd::Client> pd_client;
+};
+
+TEST_F(TestWithMockKVTSO, testConcurrentGetTS)
+{
+    constexpr size_t thread_num = 8;
+    constexpr size_t ts_per_thread = 100;
+
+    auto before = pd_client->getTSOStats();
+    std::vector<std::vector<uint64_t>> results(thread_num);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_num; i++)
+    {
+        threads.emplace_back([&, i]() {
+            for (size_t j = 0; j < ts_per_thread; j++)
+                results[i].push_back(pd_client->getTS());
+        });
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    std::set<uint64_t> all;
+    for (const auto & result : results)
+    {
+        for (size_t j = 1; j < result.size(); j++)
+            ASSERT_LT(result[j - 1], result[j]);
+        all.insert(result.begin(), result.end());
+    }
+    ASSERT_EQ(all.size(), thread_num * ts_per_thread);
+
+    auto after = pd_client->getTSOStats();
+    ASSERT_EQ(after.requests - before.requests, thread_num * ts_per_thread);
+}
+
+TEST_F(TestWithMockKVTSO, testBatchedGetTS)
+{
+    constexpr size_t ts_num = 256;
+
+    auto before = pd_client->getTSOStats();
+    std::vector<std::future<uint64_t>> futures;
+    for (size_t i = 0; i < ts_num; i++)
+        futures.push_back(pd_client->getTSAsync());
+    std::vector<uint64_t> ts;
+    for (auto & future : futures)
+        ts.push_back(future.get());
+    auto after = pd_client->getTSOStats();
+
+    ASSERT_EQ(after.requests - before.requests, ts_num);
+    ASSERT_LT(after.batches - before.batches, ts_num);
+
+    // The requests are served in order, and the timestamps of a batch are consecutive, so the sequence only jumps
+    // between batches.
+    uint64_t jumps = 0;
+    for (size_t i = 1; i < ts.size(); i++)
+    {
+        ASSERT_LT(ts[i - 1], ts[i]);
+        jumps += ts[i] != ts[i - 1] + 1;
+    }
+    ASSERT_LT(jumps, after.batches - before.batches);
+}
+
+// FlakyPD is a PD that breaks the first Tso stream, and serves timestamps on the later ones.
+class FlakyPD : public pdpb::PD::Service
+{
+public:
+    grpc::Status GetMembers(grpc::ServerContext *, const pdpb::GetMembersRequest *, pdpb::GetMembersResponse * resp) override
+    {
+        resp->mutable_header()->set_cluster_id(1);
+        resp->mutable_leader()->add_client_urls(url);
+        resp->add_members()->add_client_urls(url);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status Tso(grpc::ServerContext *, grpc::ServerReaderWriter<pdpb::TsoResponse, pdpb::TsoRequest> * stream) override
+    {
+        pdpb::TsoRequest req;
+        if (streams++ == 0)
+        {
+            stream->Read(&req);
+            return grpc::Status(grpc::StatusCode::UNAVAILABLE, "tso stream broken");
+        }
+        while (stream->Read(&req))
+        {
+            pdpb::TsoResponse resp;
+            resp.mutable_header()->set_cluster_id(1);
+            resp.set_count(req.count());
+            // The timestamp of the response is the last one of the batch.
+            logical += req.count();
+            resp.mutable_timestamp()->set_physical(1);
+            resp.mutable_timestamp()->set_logical(logical);
+            stream->Write(resp);
+        }
+        return grpc::Status::OK;
+    }
+
+    std::string url;
+    std::atomic<int> streams{0};
+    int64_t logical = 0;
+};
+
+TEST(TSOTest, testRecoverFromBrokenStream)
+{
+    FlakyPD service;
+    int port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &port);
+    builder.RegisterService(&service);
+    auto server = builder.BuildAndStart();
+    service.url = "http://127.0.0.1:" + std::to_string(port);
+
+    {
+        pd::Client pd_client({service.url});
+        ASSERT_THROW(pd_client.getTS(), Exception);
+
+        // The next batch opens a new stream.
+        ASSERT_EQ(pd_client.getTS(), (uint64_t(1) << 18) + 1);
+        ASSERT_EQ(pd_client.getTS(), (uint64_t(1) << 18) + 2);
+        ASSERT_EQ(service.streams, 2);
+    }
+
+    server->Shutdown();
+}
+
+} // namespace
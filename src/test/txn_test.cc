@@ -0,0 +1,43 @@
+#include "test_helper.h"
+
+#include <pingcap/Exception.h>
+#include <pingcap/kv/Txn.h>
+#include <pingcap/pd/MockPDClient.h>
+
+namespace
+{
+
+using namespace pingcap;
+using namespace pingcap::kv;
+
+// FailedTSPDClient fails every timestamp request.
+class FailedTSPDClient : public pd::MockPDClient
+{
+public:
+    std::future<uint64_t> getTSAsync() override
+    {
+        calls++;
+        std::promise<uint64_t> ts;
+        ts.set_exception(std::make_exception_ptr(Exception("get timestamp timeout", GRPCErrorCode)));
+        return ts.get_future();
+    }
+
+    int calls = 0;
+};
+
+TEST(TxnTest, testStartTSFailure)
+{
+    auto pd_client = std::make_shared<FailedTSPDClient>();
+    auto cluster = createCluster(pd_client);
+
+    Txn txn(cluster);
+    txn.set("abc", "1");
+    ASSERT_THROW(txn.startTS(), Exception);
+
+    // A retry must not go on with a zero start ts.
+    ASSERT_THROW(txn.startTS(), Exception);
+    ASSERT_THROW(txn.commit(), Exception);
+    ASSERT_EQ(pd_client->calls, 1);
+}
+
+} // namespace